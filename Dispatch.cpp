@@ -0,0 +1,61 @@
+#include "Dispatch.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+LongestFirstQueue::LongestFirstQueue(std::vector<double> sizes, std::size_t window)
+    : mSizes(std::move(sizes)), mWindow(std::max<std::size_t>(window, 1)), mStarted(mSizes.size()),
+      mStartTimes(mSizes.size()), mRates(mSizes.size(), -1) {}
+
+std::size_t LongestFirstQueue::Next() {
+    std::unique_lock lock(mMutex);
+    assert(mFirst < mSizes.size());
+
+    std::size_t best = mFirst;
+    double bestCost = -1;
+    for (std::size_t i = mFirst; i < std::min(mFirst + mWindow, mSizes.size()); ++i) {
+        if (mStarted[i]) {
+            continue;
+        }
+        // Ties go to the earlier task, so equal predictions keep index order.
+        double cost = Predict(i);
+        if (cost > bestCost) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+
+    mStarted[best] = true;
+    mStartTimes[best] = Clock::now();
+    while (mFirst < mSizes.size() && mStarted[mFirst]) {
+        ++mFirst;
+    }
+    return best;
+}
+
+void LongestFirstQueue::Done(std::size_t task) {
+    double seconds = std::chrono::duration<double>(Clock::now() - mStartTimes[task]).count();
+    std::unique_lock lock(mMutex);
+    if (mSizes[task] > 0) {
+        mRates[task] = seconds / mSizes[task];
+        mRateSum += mRates[task];
+        ++mRateCount;
+    }
+}
+
+double LongestFirstQueue::Predict(std::size_t task) const {
+    // Tasks finish roughly in order, so a finished neighbour is usually within a window or two.
+    std::size_t reach = 2 * mWindow;
+    for (std::size_t d = 1; d <= reach; ++d) {
+        double before = task >= d ? mRates[task - d] : -1;
+        double after = task + d < mRates.size() ? mRates[task + d] : -1;
+        if (before >= 0 && after >= 0) {
+            return mSizes[task] * (before + after) / 2;
+        }
+        if (before >= 0 || after >= 0) {
+            return mSizes[task] * std::max(before, after);
+        }
+    }
+    return mSizes[task] * (mRateCount > 0 ? mRateSum / static_cast<double>(mRateCount) : 1.0);
+}
@@ -0,0 +1,44 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Hands out tasks longest predicted first, so the slow ones start while there is still other work to overlap them
+// with, rather than whenever their turn comes and possibly last. Only tasks less than window places past the first
+// one not yet started are candidates, which bounds how far a task can run ahead of or behind index order.
+//
+// A task is predicted to take its size times the time per unit of size its nearest finished neighbour took, as
+// neighbouring frames cost about the same; before any neighbour has finished, sizes alone decide. Sizes can be in any
+// unit the work is roughly proportional to, such as pixels.
+class LongestFirstQueue {
+  public:
+    LongestFirstQueue(std::vector<double> sizes, std::size_t window);
+
+    // Starts the next task and returns its index. Call it once per task, from the thread about to run it.
+    std::size_t Next();
+
+    // Finishes a task, timing it from its Next.
+    void Done(std::size_t task);
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    double Predict(std::size_t task) const;
+
+    std::mutex mMutex;
+    std::vector<double> mSizes;
+    std::size_t mWindow;
+    std::vector<bool> mStarted;
+    std::vector<Clock::time_point> mStartTimes;
+    // Seconds per unit of size of each finished task, or -1.
+    std::vector<double> mRates;
+    // First task not yet started.
+    std::size_t mFirst = 0;
+    double mRateSum = 0;
+    std::size_t mRateCount = 0;
+};
+
+#endif
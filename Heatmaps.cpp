@@ -0,0 +1,81 @@
+#include "Heatmaps.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+// t in [0, 1] along blue, cyan, green, yellow, red.
+RgbColor Ramp(float t) {
+    constexpr RgbColor stops[] = {{0, 0, 255}, {0, 255, 255}, {0, 255, 0}, {255, 255, 0}, {255, 0, 0}};
+    constexpr int last = static_cast<int>(std::size(stops)) - 1;
+    float pos = std::clamp(t, 0.0f, 1.0f) * last;
+    int i = std::min(static_cast<int>(pos), last - 1);
+    float f = pos - static_cast<float>(i);
+    auto mix = [f](byte a, byte b) { return static_cast<byte>(std::lround(a + (b - a) * f)); };
+    return {mix(stops[i].r, stops[i + 1].r), mix(stops[i].g, stops[i + 1].g), mix(stops[i].b, stops[i + 1].b)};
+}
+} // namespace
+
+Image DepthHeatmapNew(const Quadtree::LeafList &leaves, int width, int height) {
+    Image heatmap(width, height, 3);
+    heatmap.fill({0, 0, 0});
+
+    int maxDepth = 1;
+    for (const auto &leaf : leaves) {
+        maxDepth = std::max(maxDepth, leaf.depth);
+    }
+
+    constexpr int MinOutlined = 8;
+    for (const auto &leaf : leaves) {
+        auto color = Ramp(static_cast<float>(leaf.depth) / static_cast<float>(maxDepth));
+        heatmap.rect(leaf.bounds, color);
+        if (leaf.bounds.w >= MinOutlined && leaf.bounds.h >= MinOutlined) {
+            RgbColor edge{static_cast<byte>(color.r / 2), static_cast<byte>(color.g / 2),
+                          static_cast<byte>(color.b / 2)};
+            heatmap.rect({leaf.bounds.x, leaf.bounds.y, leaf.bounds.w, 1}, edge);
+            heatmap.rect({leaf.bounds.x, leaf.bounds.y, 1, leaf.bounds.h}, edge);
+        }
+    }
+    return heatmap;
+}
+
+Image CostHeatmapNew(const Quadtree::LeafList &leaves, const std::vector<float> &leafNs, int width, int height,
+                     int tileSize) {
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<double> tileNs(static_cast<std::size_t>(tilesX) * tilesY);
+
+    for (std::size_t i = 0; i < leaves.size() && i < leafNs.size(); ++i) {
+        const Rect &b = leaves[i].bounds;
+        double nsPerPixel = leafNs[i] / (static_cast<double>(b.w) * b.h);
+        for (int ty = b.y / tileSize; ty <= (b.y + b.h - 1) / tileSize && ty < tilesY; ++ty) {
+            int y0 = std::max(b.y, ty * tileSize);
+            int y1 = std::min(b.y + b.h, (ty + 1) * tileSize);
+            for (int tx = b.x / tileSize; tx <= (b.x + b.w - 1) / tileSize && tx < tilesX; ++tx) {
+                int x0 = std::max(b.x, tx * tileSize);
+                int x1 = std::min(b.x + b.w, (tx + 1) * tileSize);
+                tileNs[static_cast<std::size_t>(ty) * tilesX + tx] += nsPerPixel * (x1 - x0) * (y1 - y0);
+            }
+        }
+    }
+
+    // Per pixel, so the partial tiles along the right and bottom edges compare fairly.
+    for (int ty = 0; ty < tilesY; ++ty) {
+        for (int tx = 0; tx < tilesX; ++tx) {
+            double area = static_cast<double>(std::min(tileSize, width - tx * tileSize)) *
+                          std::min(tileSize, height - ty * tileSize);
+            tileNs[static_cast<std::size_t>(ty) * tilesX + tx] /= area;
+        }
+    }
+
+    double maxNs = *std::max_element(tileNs.begin(), tileNs.end());
+    Image heatmap(width, height, 3);
+    for (int ty = 0; ty < tilesY; ++ty) {
+        for (int tx = 0; tx < tilesX; ++tx) {
+            double ns = tileNs[static_cast<std::size_t>(ty) * tilesX + tx];
+            auto t = maxNs > 0 ? static_cast<float>(ns / maxNs) : 0.0f;
+            heatmap.rect({tx * tileSize, ty * tileSize, tileSize, tileSize}, Ramp(t));
+        }
+    }
+    return heatmap;
+}
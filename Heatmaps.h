@@ -0,0 +1,20 @@
+#ifndef HEATMAPS_H
+#define HEATMAPS_H
+
+#include "Image.h"
+#include "Quadtree.h"
+
+#include <vector>
+
+// Debug views of a frame's leaves, colored from blue (shallow, cheap) through green to red (deep, expensive).
+
+// Each leaf filled with the color of its depth, scaled to the deepest leaf of the frame, and outlined once it's big
+// enough for the outline not to hide it.
+Image DepthHeatmapNew(const Quadtree::LeafList &leaves, int width, int height);
+
+// Render time per pixel of each tileSize square tile, from the time of each leaf as measured by Quadtree::Render, spread
+// over the tiles it covers by area. Scaled to the slowest tile of the frame.
+Image CostHeatmapNew(const Quadtree::LeafList &leaves, const std::vector<float> &leafNs, int width, int height,
+                     int tileSize);
+
+#endif
@@ -3,10 +3,24 @@
 
 #include "Image.h"
 
+#include "ImageMetrics.h"
+#include "JpegDecoder.h"
+#include "PngDecoder.h"
+#include "ScopeTrace.h"
 #include "lib/stb_image.h"
 #include "lib/stb_image_write.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_SSE2
+#endif
 
 namespace {
 template <class T> T scale(T &val, double s) {
@@ -38,25 +52,233 @@ void blend(byte *dst, const byte *src, byte srcAlpha) {
 }
 
 byte fixedMult(byte a, byte b) { return (a * b) / 255; }
+
+// Rows shorter than this go through the cache as usual; streaming partial cache lines costs more than it saves.
+constexpr std::size_t streamThreshold = 256;
+
+// Copies with non-temporal stores when the span is long enough, for pixels that won't be read again until the frame
+// is saved. Must be followed by streamFence() before anything else reads the destination.
+void streamCopy(byte *dst, const byte *src, std::size_t n) {
+#ifdef IMAGE_SSE2
+    if (n >= streamThreshold) {
+        std::size_t head = (16 - reinterpret_cast<std::uintptr_t>(dst) % 16) % 16;
+        std::memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        n -= head;
+        for (; n >= 16; n -= 16, dst += 16, src += 16) {
+            _mm_stream_si128(reinterpret_cast<__m128i *>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+        }
+    }
+#endif
+    std::memcpy(dst, src, n);
+}
+
+void streamFence() {
+#ifdef IMAGE_SSE2
+    _mm_sfence();
+#endif
+}
+
+// Distance field texels hold 128 plus this many steps per texel of distance, positive outside the silhouette, so
+// distances up to 32 texels either way fit in a byte.
+constexpr float fieldUnits = 4;
+
+// Squared distance from every pixel to the nearest one set in mask, by Felzenszwalb and Huttenlocher's lower envelope
+// of parabolas over the columns and then the rows.
+std::vector<double> squaredDistances(const std::vector<bool> &mask, int width, int height) {
+    constexpr double far = 1e20;
+    std::vector<double> dist(mask.size());
+    for (std::size_t i = 0; i < mask.size(); ++i) {
+        dist[i] = mask[i] ? 0 : far;
+    }
+
+    int longest = std::max(width, height);
+    std::vector<double> f(longest), z(longest + 1);
+    std::vector<int> v(longest);
+    auto transform = [&](double *line, int count, std::size_t step) {
+        for (int q = 0; q < count; ++q) {
+            f[q] = line[q * step];
+        }
+        int k = 0;
+        v[0] = 0;
+        z[0] = -far;
+        z[1] = far;
+        for (int q = 1; q < count; ++q) {
+            double s;
+            while ((s = (f[q] + q * q - f[v[k]] - v[k] * v[k]) / (2 * (q - v[k]))) <= z[k]) {
+                --k;
+            }
+            ++k;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = far;
+        }
+        k = 0;
+        for (int q = 0; q < count; ++q) {
+            while (z[k + 1] < q) {
+                ++k;
+            }
+            line[q * step] = (q - v[k]) * (q - v[k]) + f[v[k]];
+        }
+    };
+    for (int x = 0; x < width; ++x) {
+        transform(&dist[x], height, width);
+    }
+    for (int y = 0; y < height; ++y) {
+        transform(&dist[static_cast<std::size_t>(y) * width], width, 1);
+    }
+    return dist;
+}
+
+// Bilinear weights along one axis of a distance field: the two texels a pixel's center falls between.
+struct FieldTap {
+    int i0;
+    int i1;
+    float t;
+};
+
+FieldTap fieldTap(int i, float scale, int size) {
+    float u = std::clamp((static_cast<float>(i) + 0.5f) * scale - 0.5f, 0.0f, static_cast<float>(size - 1));
+    int i0 = static_cast<int>(u);
+    return {i0, std::min(i0 + 1, size - 1), u - static_cast<float>(i0)};
+}
+
+// The first channels of image scaled down by scale, each pixel the average of the block of up to scale by scale
+// pixels it covers; the size rounds up as a scaled JPEG decode's does.
+Image boxDownsampleNew(const Image &image, int scale, int channels) {
+    Image scaled((image.width() + scale - 1) / scale, (image.height() + scale - 1) / scale, channels);
+    for (int y = 0; y < scaled.height(); ++y) {
+        int y1 = std::min((y + 1) * scale, image.height());
+        for (int x = 0; x < scaled.width(); ++x) {
+            int x1 = std::min((x + 1) * scale, image.width());
+            int count = (y1 - y * scale) * (x1 - x * scale);
+            for (int c = 0; c < channels; ++c) {
+                int sum = 0;
+                for (int sy = y * scale; sy < y1; ++sy) {
+                    for (int sx = x * scale; sx < x1; ++sx) {
+                        sum += image(sx, sy, c);
+                    }
+                }
+                scaled(x, y, c) = static_cast<byte>((sum + count / 2) / count);
+            }
+        }
+    }
+    return scaled;
+}
+
+// Agreement expected between a scaled DecodeJpeg and stb_image's decode box filtered to the same size; real
+// differences show up far below it.
+constexpr double minJpegPsnr = 28;
+
+// Scratch row for building output pixels before they're streamed out.
+std::vector<byte> &rowBuffer(std::size_t size) {
+    thread_local std::vector<byte> row;
+    if (row.size() < size) {
+        row.resize(size);
+    }
+    return row;
+}
 } // namespace
 
 Image::Image() : mWidth(100), mHeight(100), mChannels(3), mData(mWidth * mHeight * mChannels) {}
 
 Image::Image(const char *filename) {
     uint8_t *temp = stbi_load(filename, &mWidth, &mHeight, &mChannels, 0);
+    if (!temp) {
+        throw std::runtime_error(std::string("Can't decode ") + filename + ": " + stbi_failure_reason());
+    }
     mData.insert(mData.end(), &temp[0], &temp[mWidth * mHeight * mChannels]);
     stbi_image_free(temp);
 }
 
+Image::Image(const char *filename, ImageDecoder decoder, DecodeHints hints) {
+    TRACE_SCOPE("Image::decode");
+    if (decoder != ImageDecoder::Stb) {
+        std::vector<byte> file;
+        if (std::ifstream in{filename, std::ios::binary | std::ios::ate}) {
+            file.resize(static_cast<std::size_t>(in.tellg()));
+            in.seekg(0);
+            in.read(reinterpret_cast<char *>(file.data()), static_cast<std::streamsize>(file.size()));
+        }
+        if (DecodePng(file.data(), file.size(), mData, mWidth, mHeight, mChannels)) {
+            if (decoder == ImageDecoder::Verify) {
+                Image reference(filename);
+                if (reference.mWidth != mWidth || reference.mHeight != mHeight ||
+                    reference.mChannels != mChannels || reference.mData != mData) {
+                    throw std::runtime_error(std::string("PNG decoders disagree on ") + filename);
+                }
+            }
+            return;
+        }
+        // At full size stb_image's SIMD transform is faster, so DecodeJpeg only pays off when it can skip work.
+        if (IsJpeg(file.data(), file.size()) && hints.scale > 1 &&
+            DecodeJpeg(file.data(), file.size(), hints.scale, hints.redOnly, mData, mWidth, mHeight, mChannels)) {
+            if (decoder == ImageDecoder::Verify) {
+                // A scaled inverse transform only approximates averaging the full size pixels, so the decodes only
+                // need to be close.
+                Image reference(filename);
+                if (mChannels > reference.mChannels) {
+                    throw std::runtime_error(std::string("JPEG decoders disagree on ") + filename);
+                }
+                reference = boxDownsampleNew(reference, hints.scale, mChannels);
+                if (reference.mWidth != mWidth || reference.mHeight != mHeight ||
+                    ComputePsnr(reference.view(), view()) < minJpegPsnr) {
+                    throw std::runtime_error(std::string("JPEG decoders disagree on ") + filename);
+                }
+            }
+            return;
+        }
+    }
+    *this = Image(filename);
+}
+
 Image::Image(int mWidth, int mHeight, int mChannels)
     : mWidth(mWidth), mHeight(mHeight), mChannels(mChannels), mData(mWidth * mHeight * mChannels) {}
 
+Image::Image(ImageView view)
+    : mWidth(view.width), mHeight(view.height), mChannels(view.channels),
+      mData(view.data, view.data + static_cast<std::size_t>(view.width) * view.height * view.channels) {}
+
+bool Image::info(const char *filename, int &w, int &h, int &channels) {
+    return stbi_info(filename, &w, &h, &channels) != 0;
+}
+
 bool Image::save(const char *filename) const {
+    TRACE_SCOPE("Image::save");
     int success;
     success = stbi_write_png(filename, mWidth, mHeight, mChannels, mData.data(), mWidth * mChannels);
     return success != 0;
 }
 
+uint64_t Image::hashPixels() const {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ mData.size();
+    std::size_t i = 0;
+    for (; i + sizeof(uint64_t) <= mData.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, mData.data() + i, sizeof(word));
+        h = (h ^ word) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    for (; i < mData.size(); ++i) {
+        h = (h ^ mData[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+bool Image::samePixels(const Image &other) const {
+    return mWidth == other.mWidth && mHeight == other.mHeight && mChannels == other.mChannels && mData == other.mData;
+}
+
+std::size_t Image::pngSize() const {
+    std::size_t size = 0;
+    auto count = [](void *context, void *, int n) {
+        *static_cast<std::size_t *>(context) += static_cast<std::size_t>(n);
+    };
+    stbi_write_png_to_func(count, &size, mWidth, mHeight, mChannels, mData.data(), mWidth * mChannels);
+    return size;
+}
+
 Image &Image::rescaleLuminance(float lo, float hi) {
     float min = std::numeric_limits<float>::max();
     float max = std::numeric_limits<float>::min();
@@ -163,6 +385,149 @@ Image &Image::overlay(const Image &source, int x, int y) {
     return *this;
 }
 
+Image &Image::blitTintedScaled(ImageView source, int w, int h, RgbColor tint, RgbColor background, int x, int y) {
+    TRACE_SCOPE("Image::blitTintedScaled");
+    const byte tints[3] = {tint.r, tint.g, tint.b};
+    int colorChannels = std::min(source.channels, 3);
+    int dx0 = std::max(0, -x);
+    int dx1 = std::min(w, mWidth - x);
+    if (dx0 >= dx1) {
+        return *this;
+    }
+
+    // Nearest neighbour in 16.16 fixed point; at scale 1 every step is exactly one source pixel.
+    uint64_t xStep = (static_cast<uint64_t>(source.width) << 16) / w;
+    uint64_t yStep = (static_cast<uint64_t>(source.height) << 16) / h;
+
+    auto &row = rowBuffer(static_cast<std::size_t>(dx1 - dx0) * mChannels);
+    for (int dy = std::max(0, -y); dy < h; dy++) {
+        if (dy + y >= mHeight)
+            break;
+
+        const byte *srcRow = source.pixel(0, static_cast<int>(dy * yStep >> 16));
+        byte *out = row.data();
+        uint64_t sx = dx0 * xStep;
+        for (int dx = dx0; dx < dx1; dx++, sx += xStep) {
+            const byte *srcPixel = srcRow + (sx >> 16) * source.channels;
+            byte srcAlpha = source.channels < 4 ? 255 : srcPixel[3];
+
+            byte tinted[4] = {0, 0, 0, srcAlpha};
+            for (int c = 0; c < colorChannels; ++c) {
+                tinted[c] = static_cast<byte>(srcPixel[c] * tints[c] >> 8);
+            }
+
+            // Over an opaque background the result is always opaque.
+            byte dstPixel[4] = {background.r, background.g, background.b, 255};
+            if (srcAlpha == 255) {
+                std::copy_n(tinted, 4, dstPixel);
+            } else {
+                blend(dstPixel, tinted, srcAlpha);
+            }
+            std::copy_n(dstPixel, mChannels, out);
+            out += mChannels;
+        }
+        streamCopy(pixel(dx0 + x, dy + y), row.data(), static_cast<std::size_t>(out - row.data()));
+    }
+    streamFence();
+
+    return *this;
+}
+
+Image &Image::blitTintedField(ImageView field, int w, int h, RgbColor tint, RgbColor background, int x, int y) {
+    TRACE_SCOPE("Image::blitTintedField");
+    int dx0 = std::max(0, -x);
+    int dx1 = std::min(w, mWidth - x);
+    if (dx0 >= dx1) {
+        return *this;
+    }
+
+    // Distances are in texels; scaled by the texels a pixel spans they are in pixels, so coverage ramps from 0 to 1
+    // over the pixel the edge crosses whatever the leaf size.
+    float xScale = static_cast<float>(field.width) / static_cast<float>(w);
+    float yScale = static_cast<float>(field.height) / static_cast<float>(h);
+    float toPixels = 1.0f / (fieldUnits * std::max(xScale, yScale));
+    // Pixels whose four texels are all at least this far outside show only the background, which is most of the
+    // area around a sprite; they skip the interpolation.
+    float clear = 128 + 0.5f / toPixels;
+    const byte backgroundPixel[4] = {background.r, background.g, background.b, 255};
+    // Multiplying by tint / 256 truncates the same way as blitTintedScaled's >> 8.
+    const float tints[3] = {tint.r / 256.0f, tint.g / 256.0f, tint.b / 256.0f};
+
+    thread_local std::vector<FieldTap> columns;
+    columns.resize(dx1 - dx0);
+    for (int dx = dx0; dx < dx1; ++dx) {
+        columns[dx - dx0] = fieldTap(dx, xScale, field.width);
+    }
+
+    auto &row = rowBuffer(static_cast<std::size_t>(dx1 - dx0) * mChannels);
+    for (int dy = std::max(0, -y); dy < h; dy++) {
+        if (dy + y >= mHeight)
+            break;
+
+        FieldTap ty = fieldTap(dy, yScale, field.height);
+        const byte *top = field.pixel(0, ty.i0);
+        const byte *bottom = field.pixel(0, ty.i1);
+        byte *out = row.data();
+#ifdef IMAGE_SSE2
+        // One texel's color and distance are the four lanes of a vector, so the four taps blend at once.
+        __m128i zero = _mm_setzero_si128();
+        auto load = [&](const byte *p) {
+            int32_t bits;
+            std::memcpy(&bits, p, 4);
+            return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero));
+        };
+        __m128 fy = _mm_set1_ps(ty.t);
+#endif
+        for (const auto &tx : columns) {
+            if (std::min({top[tx.i0 * 4 + 3], top[tx.i1 * 4 + 3], bottom[tx.i0 * 4 + 3], bottom[tx.i1 * 4 + 3]}) >=
+                clear) {
+                std::copy_n(backgroundPixel, mChannels, out);
+                out += mChannels;
+                continue;
+            }
+
+            alignas(16) float texel[4];
+#ifdef IMAGE_SSE2
+            __m128 fx = _mm_set1_ps(tx.t);
+            __m128 a = load(top + tx.i0 * 4);
+            __m128 b = load(top + tx.i1 * 4);
+            __m128 c = load(bottom + tx.i0 * 4);
+            __m128 d = load(bottom + tx.i1 * 4);
+            __m128 upper = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fx));
+            __m128 lower = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), fx));
+            _mm_store_ps(texel, _mm_add_ps(upper, _mm_mul_ps(_mm_sub_ps(lower, upper), fy)));
+#else
+            for (int k = 0; k < 4; ++k) {
+                float a = top[tx.i0 * 4 + k], b = top[tx.i1 * 4 + k];
+                float c = bottom[tx.i0 * 4 + k], d = bottom[tx.i1 * 4 + k];
+                float upper = a + (b - a) * tx.t;
+                float lower = c + (d - c) * tx.t;
+                texel[k] = upper + (lower - upper) * ty.t;
+            }
+#endif
+            float coverage = std::clamp(0.5f - (texel[3] - 128) * toPixels, 0.0f, 1.0f);
+            auto srcAlpha = static_cast<byte>(coverage * 255 + 0.5f);
+            byte tinted[3];
+            for (int k = 0; k < 3; ++k) {
+                tinted[k] = static_cast<byte>(texel[k] * tints[k]);
+            }
+
+            byte dstPixel[4] = {background.r, background.g, background.b, 255};
+            if (srcAlpha == 255) {
+                std::copy_n(tinted, 3, dstPixel);
+            } else if (srcAlpha > 0) {
+                blend(dstPixel, tinted, srcAlpha);
+            }
+            std::copy_n(dstPixel, mChannels, out);
+            out += mChannels;
+        }
+        streamCopy(pixel(dx0 + x, dy + y), row.data(), static_cast<std::size_t>(out - row.data()));
+    }
+    streamFence();
+
+    return *this;
+}
+
 Image &Image::rect(Rect r, RgbColor color) {
     uint8_t colors[4] = {color.r, color.g, color.b, 255};
     for (int y = std::max(0, r.y); y < std::min(r.y + r.h, mHeight); y++) {
@@ -174,18 +539,256 @@ Image &Image::rect(Rect r, RgbColor color) {
     return *this;
 }
 
+Image &Image::fill(RgbColor color) {
+    TRACE_SCOPE("Image::fill");
+    uint8_t colors[4] = {color.r, color.g, color.b, 255};
+    std::size_t stride = static_cast<std::size_t>(mWidth) * mChannels;
+    auto &row = rowBuffer(stride);
+    for (int x = 0; x < mWidth; x++) {
+        std::copy_n(colors, mChannels, row.data() + x * mChannels);
+    }
+    for (int y = 0; y < mHeight; y++) {
+        streamCopy(pixel(0, y), row.data(), stride);
+    }
+    streamFence();
+
+    return *this;
+}
+
 Image Image::resizeFastNew(int rw, int rh) const {
+    TRACE_SCOPE("Image::resizeFastNew");
     Image resizedImage(rw, rh, mChannels);
+    resizeFastRows(resizedImage, 0, mHeight);
+    return resizedImage;
+}
+
+int Image::resizeFastRows(Image &dst, int y0, int srcRows) const {
+    int rw = dst.width();
+    int rh = dst.height();
     double x_ratio = mWidth / (double)rw;
     double y_ratio = mHeight / (double)rh;
-    for (int y = 0; y < rh; y++) {
+    int y = y0;
+    for (; y < rh; y++) {
+        int ry = static_cast<int>(y * y_ratio);
+        if (ry >= srcRows) {
+            break;
+        }
         for (int x = 0; x < rw; x++) {
             int rx = static_cast<int>(x * x_ratio);
-            int ry = static_cast<int>(y * y_ratio);
-            std::copy_n(pixel(rx, ry), mChannels, resizedImage.pixel(x, y));
+            std::copy_n(pixel(rx, ry), mChannels, dst.pixel(x, y));
         }
     }
-    return resizedImage;
+    return y;
+}
+
+namespace {
+// BT.601 studio range, the default for encoders fed yuv420p.
+byte rgbToY(int r, int g, int b) { return static_cast<byte>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); }
+byte rgbToU(int r, int g, int b) { return static_cast<byte>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128); }
+byte rgbToV(int r, int g, int b) { return static_cast<byte>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128); }
+} // namespace
+
+std::vector<byte> Image::yuv420New() const {
+    TRACE_SCOPE("Image::yuv420New");
+    int cw = (mWidth + 1) / 2;
+    int ch = (mHeight + 1) / 2;
+    std::vector<byte> planes(static_cast<std::size_t>(mWidth) * mHeight + 2 * static_cast<std::size_t>(cw) * ch);
+    byte *yPlane = planes.data();
+    byte *uPlane = yPlane + static_cast<std::size_t>(mWidth) * mHeight;
+    byte *vPlane = uPlane + static_cast<std::size_t>(cw) * ch;
+
+    auto rgb = [this](int x, int y, int &r, int &g, int &b) {
+        const byte *p = pixel(x, y);
+        r = p[0];
+        g = mChannels >= 3 ? p[1] : p[0];
+        b = mChannels >= 3 ? p[2] : p[0];
+    };
+
+    // Two rows at a time, so each 2x2 block's chroma is averaged while its pixels are at hand. Odd edges repeat
+    // the last row or column.
+    for (int cy = 0; cy < ch; ++cy) {
+        int rows[2] = {2 * cy, std::min(2 * cy + 1, mHeight - 1)};
+        byte *yRows[2] = {yPlane + static_cast<std::size_t>(rows[0]) * mWidth,
+                          yPlane + static_cast<std::size_t>(rows[1]) * mWidth};
+        byte *uRow = uPlane + static_cast<std::size_t>(cy) * cw;
+        byte *vRow = vPlane + static_cast<std::size_t>(cy) * cw;
+
+        int cx = 0;
+#ifdef IMAGE_SSE2
+        // SSE2 has no byte shuffle to deinterleave packed pixels, so they are gathered into 16-bit lanes and only the
+        // arithmetic is vectorized: 16 luma and 8 chroma samples per row pair per step. Luma sums stay below 2^16,
+        // chroma ones fit in a signed 16-bit lane, and rounding matches the scalar code exactly.
+        for (; 2 * cx + 16 <= mWidth; cx += 8) {
+            alignas(16) uint16_t r[2][16], g[2][16], b[2][16];
+            alignas(16) int16_t cr[8], cg[8], cb[8];
+            for (int k = 0; k < 2; ++k) {
+                for (int i = 0; i < 16; ++i) {
+                    int pr, pg, pb;
+                    rgb(2 * cx + i, rows[k], pr, pg, pb);
+                    r[k][i] = static_cast<uint16_t>(pr);
+                    g[k][i] = static_cast<uint16_t>(pg);
+                    b[k][i] = static_cast<uint16_t>(pb);
+                }
+            }
+            for (int i = 0; i < 8; ++i) {
+                cr[i] = static_cast<int16_t>((r[0][2 * i] + r[0][2 * i + 1] + r[1][2 * i] + r[1][2 * i + 1] + 2) >> 2);
+                cg[i] = static_cast<int16_t>((g[0][2 * i] + g[0][2 * i + 1] + g[1][2 * i] + g[1][2 * i + 1] + 2) >> 2);
+                cb[i] = static_cast<int16_t>((b[0][2 * i] + b[0][2 * i + 1] + b[1][2 * i] + b[1][2 * i + 1] + 2) >> 2);
+            }
+
+            auto load = [](const void *p) { return _mm_load_si128(static_cast<const __m128i *>(p)); };
+            auto weigh = [](__m128i x, int w) { return _mm_mullo_epi16(x, _mm_set1_epi16(static_cast<int16_t>(w))); };
+            const __m128i round = _mm_set1_epi16(128);
+            for (int k = 0; k < 2; ++k) {
+                __m128i luma[2];
+                for (int h = 0; h < 2; ++h) {
+                    __m128i sum = _mm_add_epi16(_mm_add_epi16(weigh(load(r[k] + 8 * h), 66), weigh(load(g[k] + 8 * h), 129)),
+                                                _mm_add_epi16(weigh(load(b[k] + 8 * h), 25), round));
+                    luma[h] = _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(yRows[k] + 2 * cx), _mm_packus_epi16(luma[0], luma[1]));
+            }
+
+            auto chroma = [&](int wr, int wg, int wb) {
+                __m128i sum = _mm_add_epi16(_mm_add_epi16(weigh(load(cr), wr), weigh(load(cg), wg)),
+                                            _mm_add_epi16(weigh(load(cb), wb), round));
+                __m128i value = _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+                return _mm_packus_epi16(value, value);
+            };
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(uRow + cx), chroma(-38, -74, 112));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(vRow + cx), chroma(112, -94, -18));
+        }
+#endif
+        for (; cx < cw; ++cx) {
+            int cols[2] = {2 * cx, std::min(2 * cx + 1, mWidth - 1)};
+            int sumR = 0;
+            int sumG = 0;
+            int sumB = 0;
+            for (int k = 0; k < 2; ++k) {
+                for (int i = 0; i < 2; ++i) {
+                    int r, g, b;
+                    rgb(cols[i], rows[k], r, g, b);
+                    yRows[k][cols[i]] = rgbToY(r, g, b);
+                    sumR += r;
+                    sumG += g;
+                    sumB += b;
+                }
+            }
+            int r = (sumR + 2) >> 2;
+            int g = (sumG + 2) >> 2;
+            int b = (sumB + 2) >> 2;
+            uRow[cx] = rgbToU(r, g, b);
+            vRow[cx] = rgbToV(r, g, b);
+        }
+    }
+    return planes;
+}
+
+Image Image::halveNew() const {
+    TRACE_SCOPE("Image::halveNew");
+    int hw = std::max(mWidth / 2, 1);
+    int hh = std::max(mHeight / 2, 1);
+    Image halved(hw, hh, mChannels);
+    for (int y = 0; y < hh; y++) {
+        int y0 = std::min(2 * y, mHeight - 1);
+        int y1 = std::min(2 * y + 1, mHeight - 1);
+        for (int x = 0; x < hw; x++) {
+            int x0 = std::min(2 * x, mWidth - 1);
+            int x1 = std::min(2 * x + 1, mWidth - 1);
+            for (int c = 0; c < mChannels; c++) {
+                int sum = (*this)(x0, y0, c) + (*this)(x1, y0, c) + (*this)(x0, y1, c) + (*this)(x1, y1, c);
+                halved(x, y, c) = static_cast<byte>((sum + 2) / 4);
+            }
+        }
+    }
+    return halved;
+}
+
+Image Image::distanceFieldNew(int maxSide) const {
+    TRACE_SCOPE("Image::distanceFieldNew");
+    std::size_t count = static_cast<std::size_t>(mWidth) * mHeight;
+    bool hasAlpha = mChannels == 2 || mChannels == 4;
+    std::vector<bool> inside(count);
+    std::vector<bool> outside(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        inside[i] = !hasAlpha || mData[i * mChannels + mChannels - 1] >= 128;
+        outside[i] = !inside[i];
+    }
+    auto toInside = squaredDistances(inside, mWidth, mHeight);
+    auto toOutside = squaredDistances(outside, mWidth, mHeight);
+
+    int cell = std::max((std::max(mWidth, mHeight) + maxSide - 1) / maxSide, 1);
+    int fw = (mWidth + cell - 1) / cell;
+    int fh = (mHeight + cell - 1) / cell;
+    Image field(fw, fh, 4);
+    std::vector<bool> covered(static_cast<std::size_t>(fw) * fh);
+    for (int ty = 0; ty < fh; ++ty) {
+        for (int tx = 0; tx < fw; ++tx) {
+            // Pixel centers are half a pixel inside or outside the edge, and the distance is roughly linear across
+            // a texel, so the texel's is the average of its pixels'.
+            double distance = 0;
+            int pixels = 0;
+            int opaque = 0;
+            int sums[3] = {};
+            for (int y = ty * cell; y < std::min((ty + 1) * cell, mHeight); ++y) {
+                for (int x = tx * cell; x < std::min((tx + 1) * cell, mWidth); ++x) {
+                    std::size_t i = static_cast<std::size_t>(y) * mWidth + x;
+                    ++pixels;
+                    if (inside[i]) {
+                        distance += 0.5 - std::sqrt(toOutside[i]);
+                        const byte *p = pixel(x, y);
+                        for (int c = 0; c < 3; ++c) {
+                            sums[c] += p[mChannels >= 3 ? c : 0];
+                        }
+                        ++opaque;
+                    } else {
+                        distance += std::sqrt(toInside[i]) - 0.5;
+                    }
+                }
+            }
+            byte *texel = field.pixel(tx, ty);
+            for (int c = 0; c < 3 && opaque > 0; ++c) {
+                texel[c] = static_cast<byte>((sums[c] + opaque / 2) / opaque);
+            }
+            texel[3] = bound<byte>(128 + fieldUnits * distance / pixels / cell);
+            covered[static_cast<std::size_t>(ty) * fw + tx] = opaque > 0;
+        }
+    }
+
+    // Texels outside the silhouette still get sampled along its edge, so they take their covered neighbours' colors
+    // instead of staying black, spreading outwards until every texel has one.
+    for (bool grown = true; grown;) {
+        grown = false;
+        auto next = covered;
+        for (int ty = 0; ty < fh; ++ty) {
+            for (int tx = 0; tx < fw; ++tx) {
+                if (covered[static_cast<std::size_t>(ty) * fw + tx]) {
+                    continue;
+                }
+                int sums[3] = {};
+                int neighbours = 0;
+                for (int ny = std::max(ty - 1, 0); ny <= std::min(ty + 1, fh - 1); ++ny) {
+                    for (int nx = std::max(tx - 1, 0); nx <= std::min(tx + 1, fw - 1); ++nx) {
+                        if (covered[static_cast<std::size_t>(ny) * fw + nx]) {
+                            for (int c = 0; c < 3; ++c) {
+                                sums[c] += field(nx, ny, c);
+                            }
+                            ++neighbours;
+                        }
+                    }
+                }
+                if (neighbours > 0) {
+                    for (int c = 0; c < 3; ++c) {
+                        field(tx, ty, c) = static_cast<byte>((sums[c] + neighbours / 2) / neighbours);
+                    }
+                    next[static_cast<std::size_t>(ty) * fw + tx] = true;
+                    grown = true;
+                }
+            }
+        }
+        covered = std::move(next);
+    }
+    return field;
 }
 
 Image Image::cropNew(int cx, int cy, int cw, int ch) const {
@@ -204,3 +807,16 @@ Image Image::cropNew(int cx, int cy, int cw, int ch) const {
 
     return croppedImage;
 }
+
+Image Image::lumaNew() const {
+    TRACE_SCOPE("Image::lumaNew");
+    Image luma(mWidth, mHeight, 1);
+    for (int y = 0; y < mHeight; y++) {
+        for (int x = 0; x < mWidth; x++) {
+            const byte *p = pixel(x, y);
+            // BT.709 weights in 8-bit fixed point, matching rescaleLuminance.
+            luma.pixel(x, y)[0] = mChannels < 3 ? p[0] : static_cast<byte>((54 * p[0] + 183 * p[1] + 19 * p[2]) >> 8);
+        }
+    }
+    return luma;
+}
@@ -21,6 +21,34 @@ struct Rect {
     int h;
 };
 
+// Read-only pixels owned elsewhere, e.g. by an Image or a shared memory segment.
+struct ImageView {
+    const byte *data;
+    int width;
+    int height;
+    int channels;
+
+    const byte *pixel(int x, int y) const { return data + (x + y * width) * channels; }
+};
+
+// How Image(filename, decoder) decodes PNGs and JPEGs.
+enum class ImageDecoder {
+    Stb,
+    // DecodePng or DecodeJpeg, falling back to stb_image for the files they don't handle.
+    Fast,
+    // Both, throwing if they disagree.
+    Verify,
+};
+
+// What the caller needs from a decode, which a JPEG can be decoded to directly for less than a full decode costs.
+// Other formats ignore them.
+struct DecodeHints {
+    // Power of two up to 8 to divide the size by, rounding up.
+    int scale = 1;
+    // Only the red channel is needed; a color JPEG may decode to that one channel.
+    bool redOnly = false;
+};
+
 struct Image {
   private:
     int mWidth;
@@ -30,8 +58,13 @@ struct Image {
 
   public:
     Image();
+    // Throws std::runtime_error if stb_image can't decode the file.
     Image(const char* filename);
+    Image(const char *filename, ImageDecoder decoder, DecodeHints hints = {});
     Image(int w, int h, int channels);
+    explicit Image(ImageView view);
+
+    static bool info(const char *filename, int &w, int &h, int &channels);
 
     int width() const { return mWidth; }
     int height() const { return mHeight; }
@@ -43,7 +76,16 @@ struct Image {
     uint8_t *pixel(int x, int y) { return mData.data() + (x + y * mWidth) * mChannels; }
     const uint8_t *pixel(int x, int y) const { return mData.data() + (x + y * mWidth) * mChannels; }
 
+    ImageView view() const { return {mData.data(), mWidth, mHeight, mChannels}; }
+    std::size_t byteSize() const { return mData.size(); }
+    // Hash of every pixel, for spotting identical images.
+    uint64_t hashPixels() const;
+    // Same size, channels and pixels.
+    bool samePixels(const Image &other) const;
+
     bool save(const char *filename) const;
+    // Bytes save() would write, without writing them anywhere.
+    std::size_t pngSize() const;
 
     Image &rescaleLuminance(float lo, float hi);
     Image &rescaleLuminance(float hi) { return rescaleLuminance(0, hi); }
@@ -55,10 +97,30 @@ struct Image {
     Image colorMaskNew(uint8_t r, uint8_t g, uint8_t b) const;
     Image colorMaskNew(const RgbColor &color) const { return colorMaskNew(color.r, color.g, color.b); }
     Image &overlay(const Image &source, int x, int y);
+    // Same as rect({x, y, w, h}, background).overlay(source resized to w by h and colorMaskNew(tint), x, y), but
+    // sampling the source directly and never reading the destination; long rows go out with streaming stores.
+    Image &blitTintedScaled(ImageView source, int w, int h, RgbColor tint, RgbColor background, int x, int y);
+    // Same for a field made by distanceFieldNew, interpolated to w by h with its edge antialiased over one pixel.
+    Image &blitTintedField(ImageView field, int w, int h, RgbColor tint, RgbColor background, int x, int y);
     Image resizeFastNew(int rw, int rh) const;
+    // Fills dst's rows from y0 on as resizeFastNew(dst.width(), dst.height()) would, up to the first one sampling a
+    // row at or below srcRows, and returns that row; for scaling an image that is still being drawn.
+    int resizeFastRows(Image &dst, int y0, int srcRows) const;
+    // Half the size in each dimension, each pixel the average of a 2x2 block.
+    Image halveNew() const;
+    // The opaque silhouette as a signed distance field at most maxSide texels wide and high. Each texel holds the
+    // average color of the opaque pixels it covers, or of the nearest texels that cover some, and in place of alpha
+    // the distance from its pixels to the silhouette's edge. Partial transparency inside the silhouette is lost.
+    Image distanceFieldNew(int maxSide) const;
+    // Planar YUV 4:2:0 (BT.601 studio range): the Y plane followed by the U and V planes at half resolution, each
+    // chroma sample the average of a 2x2 block.
+    std::vector<byte> yuv420New() const;
     Image cropNew(int cx, int cy, int cw, int ch) const;
+    Image lumaNew() const;
 
     Image &rect(Rect r, RgbColor color);
+    // Fills the whole image with streaming stores, so clearing it doesn't evict anything from the cache.
+    Image &fill(RgbColor color);
 };
 
 #endif
@@ -0,0 +1,182 @@
+#include "ImageMetrics.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGEMETRICS_SSE2
+#endif
+
+namespace {
+constexpr int Window = 8;
+constexpr int WindowStep = 4;
+
+#ifdef IMAGEMETRICS_SSE2
+int64_t HorizontalSum(__m128i v) {
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), v);
+    return static_cast<int64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+// Sum of squared differences of n bytes.
+int64_t SquaredError(const byte *a, const byte *b, std::size_t n) {
+    int64_t sum = 0;
+    std::size_t i = 0;
+#ifdef IMAGEMETRICS_SSE2
+    // Each 32-bit lane gains at most 4 * 255^2 per 16 bytes, so flush well before 8000 iterations.
+    constexpr std::size_t FlushBytes = 16 * 4096;
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= n) {
+        __m128i acc = zero;
+        std::size_t end = std::min(n, i + FlushBytes);
+        for (; i + 16 <= end; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        sum += HorizontalSum(acc);
+    }
+#endif
+    for (; i < n; ++i) {
+        int d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+// Sums of x, y, x^2, y^2 and xy over a window.
+struct WindowSums {
+    int64_t x = 0;
+    int64_t y = 0;
+    int64_t xx = 0;
+    int64_t yy = 0;
+    int64_t xy = 0;
+};
+
+WindowSums SumWindow(ImageView a, ImageView b, int x0, int y0) {
+    WindowSums s;
+#ifdef IMAGEMETRICS_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sx = zero, sy = zero, sxx = zero, syy = zero, sxy = zero;
+    for (int y = y0; y < y0 + Window; ++y) {
+        __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(a.pixel(x0, y))), zero);
+        __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(b.pixel(x0, y))), zero);
+        sx = _mm_add_epi32(sx, _mm_madd_epi16(va, ones));
+        sy = _mm_add_epi32(sy, _mm_madd_epi16(vb, ones));
+        sxx = _mm_add_epi32(sxx, _mm_madd_epi16(va, va));
+        syy = _mm_add_epi32(syy, _mm_madd_epi16(vb, vb));
+        sxy = _mm_add_epi32(sxy, _mm_madd_epi16(va, vb));
+    }
+    s = {HorizontalSum(sx), HorizontalSum(sy), HorizontalSum(sxx), HorizontalSum(syy), HorizontalSum(sxy)};
+#else
+    for (int y = y0; y < y0 + Window; ++y) {
+        const byte *pa = a.pixel(x0, y);
+        const byte *pb = b.pixel(x0, y);
+        for (int x = 0; x < Window; ++x) {
+            s.x += pa[x];
+            s.y += pb[x];
+            s.xx += pa[x] * pa[x];
+            s.yy += pb[x] * pb[x];
+            s.xy += pa[x] * pb[x];
+        }
+    }
+#endif
+    return s;
+}
+} // namespace
+
+double ComputePsnr(ImageView reference, ImageView approx) {
+    std::size_t n = static_cast<std::size_t>(reference.width) * reference.height * reference.channels;
+    int64_t error = SquaredError(reference.data, approx.data, n);
+    if (error == 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    double mse = static_cast<double>(error) / static_cast<double>(n);
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+double EstimateIntraBits(ImageView image, int step) {
+    constexpr int Block = 8;
+    constexpr double SignAndRunBits = 3;
+    // Orthonormal DCT-II basis, row k holding frequency k.
+    static const auto basis = [] {
+        std::array<std::array<double, Block>, Block> b{};
+        for (int k = 0; k < Block; ++k) {
+            double scale = std::sqrt((k == 0 ? 1.0 : 2.0) / Block);
+            for (int n = 0; n < Block; ++n) {
+                b[k][n] = scale * std::cos((2 * n + 1) * k * 3.14159265358979323846 / (2 * Block));
+            }
+        }
+        return b;
+    }();
+
+    double bits = 0;
+    double levelStep = std::max(step, 1);
+    for (int by = 0; by < image.height; by += Block) {
+        for (int bx = 0; bx < image.width; bx += Block) {
+            double block[Block][Block];
+            for (int y = 0; y < Block; ++y) {
+                for (int x = 0; x < Block; ++x) {
+                    int px = std::min(bx + x, image.width - 1);
+                    int py = std::min(by + y, image.height - 1);
+                    block[y][x] = image.pixel(px, py)[0] - 128.0;
+                }
+            }
+            double rows[Block][Block];
+            for (int y = 0; y < Block; ++y) {
+                for (int k = 0; k < Block; ++k) {
+                    double sum = 0;
+                    for (int x = 0; x < Block; ++x) {
+                        sum += basis[k][x] * block[y][x];
+                    }
+                    rows[y][k] = sum;
+                }
+            }
+            // End of block.
+            bits += 1;
+            for (int k = 0; k < Block; ++k) {
+                for (int j = 0; j < Block; ++j) {
+                    double sum = 0;
+                    for (int y = 0; y < Block; ++y) {
+                        sum += basis[j][y] * rows[y][k];
+                    }
+                    auto level = std::abs(std::lround(sum / levelStep));
+                    if (level > 0) {
+                        bits += 2 * std::floor(std::log2(static_cast<double>(level))) + 1 + SignAndRunBits;
+                    }
+                }
+            }
+        }
+    }
+    return bits;
+}
+
+double ComputeSsim(ImageView reference, ImageView approx) {
+    constexpr double C1 = (0.01 * 255) * (0.01 * 255);
+    constexpr double C2 = (0.03 * 255) * (0.03 * 255);
+    constexpr double N = Window * Window;
+
+    double total = 0;
+    int count = 0;
+    for (int y = 0; y + Window <= reference.height; y += WindowStep) {
+        for (int x = 0; x + Window <= reference.width; x += WindowStep) {
+            auto s = SumWindow(reference, approx, x, y);
+            double mx = static_cast<double>(s.x) / N;
+            double my = static_cast<double>(s.y) / N;
+            double vx = static_cast<double>(s.xx) / N - mx * mx;
+            double vy = static_cast<double>(s.yy) / N - my * my;
+            double cxy = static_cast<double>(s.xy) / N - mx * my;
+            total += (2 * mx * my + C1) * (2 * cxy + C2) / ((mx * mx + my * my + C1) * (vx + vy + C2));
+            ++count;
+        }
+    }
+    return count > 0 ? total / count : 1.0;
+}
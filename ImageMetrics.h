@@ -0,0 +1,22 @@
+#ifndef IMAGEMETRICS_H
+#define IMAGEMETRICS_H
+
+#include "Image.h"
+
+// Quality of an approximation against a reference of the same dimensions and channel count.
+
+// Peak signal to noise ratio over every channel, in dB. Infinite for identical images.
+double ComputePsnr(ImageView reference, ImageView approx);
+
+// Mean structural similarity (0-1, 1 for identical images) of single channel images, e.g. from Image::lumaNew. Uses
+// the usual constants but a flat 8x8 window stepped by 4 pixels rather than a Gaussian one, so each window is a few
+// multiply-adds per row.
+double ComputeSsim(ImageView reference, ImageView approx);
+
+// Rough size in bits of a single channel image coded by an intra-only transform coder: every 8x8 block, edge blocks
+// padded by repeating their last pixels, goes through a DCT and a flat quantizer of this step, and each nonzero level
+// costs an exp-Golomb code, a sign and a run. Only meant for comparing images, e.g. how much the leaf edges cutting
+// through a video encoder's blocks cost it.
+double EstimateIntraBits(ImageView image, int step);
+
+#endif
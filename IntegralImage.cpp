@@ -0,0 +1,52 @@
+#include "IntegralImage.h"
+
+#include "ScopeTrace.h"
+
+#include <algorithm>
+
+IntegralImage::IntegralImage(const Image &image)
+    : mWidth(image.width()), mHeight(image.height()), mChannels(image.channels()),
+      mData(static_cast<std::size_t>(mWidth + 1) * (mHeight + 1) * mChannels) {
+    TRACE_SCOPE("IntegralImage");
+    std::vector<uint32_t> rowSum(mChannels);
+    for (int y = 0; y < mHeight; ++y) {
+        std::fill(rowSum.begin(), rowSum.end(), 0);
+        const uint32_t *above = &mData[static_cast<std::size_t>(y) * (mWidth + 1) * mChannels];
+        uint32_t *out = &mData[static_cast<std::size_t>(y + 1) * (mWidth + 1) * mChannels];
+        const byte *src = image.pixel(0, y);
+        for (int x = 0; x < mWidth; ++x) {
+            for (int c = 0; c < mChannels; ++c) {
+                rowSum[c] += src[c];
+                out[mChannels + c] = above[mChannels + c] + rowSum[c];
+            }
+            src += mChannels;
+            above += mChannels;
+            out += mChannels;
+        }
+    }
+}
+
+Image IntegralImage::BoxFilter(int radius) const {
+    TRACE_SCOPE("IntegralImage::BoxFilter");
+    // A window as large as the image already covers all of it from every pixel.
+    radius = std::clamp(radius, 0, std::max(mWidth, mHeight));
+    Image filtered(mWidth, mHeight, mChannels);
+    std::size_t stride = static_cast<std::size_t>(mWidth + 1) * mChannels;
+    for (int y = 0; y < mHeight; ++y) {
+        int top = std::max(y - radius, 0);
+        int bottom = std::min(y + radius + 1, mHeight);
+        const uint32_t *above = &mData[top * stride];
+        const uint32_t *below = &mData[bottom * stride];
+        byte *dst = filtered.pixel(0, y);
+        for (int x = 0; x < mWidth; ++x) {
+            int left = std::max(x - radius, 0) * mChannels;
+            int right = std::min(x + radius + 1, mWidth) * mChannels;
+            uint64_t area = static_cast<uint64_t>((right - left) / mChannels) * (bottom - top);
+            for (int c = 0; c < mChannels; ++c) {
+                uint64_t sum = below[right + c] - below[left + c] - above[right + c] + above[left + c];
+                *dst++ = static_cast<byte>((sum + area / 2) / area);
+            }
+        }
+    }
+    return filtered;
+}
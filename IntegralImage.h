@@ -0,0 +1,37 @@
+#ifndef INTEGRALIMAGE_H
+#define INTEGRALIMAGE_H
+
+#include "Image.h"
+
+#include <cstdint>
+#include <vector>
+
+// Summed-area table over every channel of an image, so the sum of any rectangle is four lookups.
+// Entries are accumulated modulo 2^32; differences are exact as long as a single rectangle sums to less than 2^32,
+// which holds for any rectangle of up to 16M pixels.
+class IntegralImage {
+  public:
+    explicit IntegralImage(const Image &image);
+
+    int Width() const { return mWidth; }
+    int Height() const { return mHeight; }
+    int Channels() const { return mChannels; }
+
+    uint32_t Sum(Rect r, int c) const {
+        return At(r.x + r.w, r.y + r.h, c) - At(r.x, r.y + r.h, c) - At(r.x + r.w, r.y, c) + At(r.x, r.y, c);
+    }
+
+    // The image box filtered with a (2 * radius + 1) square window, clipped at the edges. Each pixel is one Sum, so
+    // the cost doesn't depend on the radius.
+    Image BoxFilter(int radius) const;
+
+  private:
+    uint32_t At(int x, int y, int c) const { return mData[(x + y * (mWidth + 1)) * mChannels + c]; }
+
+    int mWidth;
+    int mHeight;
+    int mChannels;
+    std::vector<uint32_t> mData;
+};
+
+#endif
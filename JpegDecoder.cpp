@@ -0,0 +1,587 @@
+#include "JpegDecoder.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numbers>
+
+namespace {
+// Natural (row major) position of each coefficient in zigzag order.
+constexpr std::array<uint8_t, 64> zigzag = {0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+                                            12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+                                            35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                                            58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// Largest magnitudes of baseline DC differences and AC values, in bits, and a bound on the DC prediction that any
+// 8-bit image stays well within; together they keep dequantized coefficients far from overflowing.
+constexpr int maxDcBits = 11;
+constexpr int maxAcBits = 10;
+constexpr int maxDc = 1 << 12;
+
+uint16_t ReadBE16(const byte *p) { return static_cast<uint16_t>(p[0] << 8 | p[1]); }
+
+// Entropy coded data is read most significant bit first, with a 0x00 stuffed after every 0xFF. Reading stops at the
+// first marker, after which zeros are shifted in; Overrun() reports once those are used.
+class BitReader {
+  public:
+    BitReader(const byte *data, const byte *end) : mPos(data), mEnd(end) {}
+
+    // Buffers at least 32 bits, enough for a Huffman code and the value bits that follow it. Tops up a byte at a time
+    // to 57 bits once it drops below that, so most calls return straight away.
+    void Refill() {
+        if (mCount >= 32) {
+            return;
+        }
+        while (mCount <= 56) {
+            uint64_t b = 0;
+            if (!mAtMarker && mPos < mEnd && *mPos != 0xFF) {
+                b = *mPos++;
+            } else if (!mAtMarker && mPos + 1 < mEnd && mPos[1] == 0x00) {
+                b = 0xFF;
+                mPos += 2;
+            } else {
+                mAtMarker = mPos < mEnd;
+                mPastEnd += 8;
+            }
+            mBits |= b << (56 - mCount);
+            mCount += 8;
+        }
+    }
+
+    uint32_t Peek(int n) const { return static_cast<uint32_t>(mBits >> (64 - n)); }
+
+    void Consume(int n) {
+        mBits <<= n;
+        mCount -= n;
+    }
+
+    // n bits as a signed coefficient value, per the JPEG EXTEND procedure.
+    int32_t ReadSigned(int n) {
+        if (n == 0) {
+            return 0;
+        }
+        auto v = static_cast<int32_t>(Peek(n));
+        Consume(n);
+        return v < (1 << (n - 1)) ? v - (1 << n) + 1 : v;
+    }
+
+    // Skips to the restart marker that must follow a restart interval and past it.
+    bool Restart() {
+        while (!mAtMarker && mPos < mEnd) {
+            mBits = 0;
+            mCount = 0;
+            Refill();
+        }
+        mBits = 0;
+        mCount = 0;
+        mPastEnd = 0;
+        if (!mAtMarker || mPos + 1 >= mEnd || mPos[1] < 0xD0 || mPos[1] > 0xD7) {
+            return false;
+        }
+        mPos += 2;
+        mAtMarker = false;
+        return true;
+    }
+
+    bool Overrun() const { return mPastEnd > mCount; }
+
+  private:
+    const byte *mPos;
+    const byte *mEnd;
+    uint64_t mBits = 0;
+    int mCount = 0;
+    int mPastEnd = 0;
+    bool mAtMarker = false;
+};
+
+constexpr int fastBits = 9;
+
+// Canonical Huffman code as stored in a DHT segment. Codes of up to fastBits bits are a single lookup, longer ones are
+// compared against the largest code of each length.
+class Huffman {
+  public:
+    bool Build(const byte *counts, const byte *symbols, int symbolCount) {
+        mFast.fill(0);
+        mSymbols.assign(symbols, symbols + symbolCount);
+        int code = 0;
+        int index = 0;
+        for (int len = 1; len <= 16; ++len) {
+            mOffset[len] = index - code;
+            for (int i = 0; i < counts[len - 1]; ++i, ++index, ++code) {
+                if (code >= 1 << len) {
+                    return false;
+                }
+                if (len <= fastBits) {
+                    int shift = fastBits - len;
+                    for (int fill = 0; fill < 1 << shift; ++fill) {
+                        mFast[(code << shift) | fill] = static_cast<uint16_t>(len << 8 | symbols[index]);
+                    }
+                }
+            }
+            mMaxCode[len] = counts[len - 1] ? code - 1 : -1;
+            code <<= 1;
+        }
+        mValid = true;
+        return true;
+    }
+
+    bool Valid() const { return mValid; }
+
+    // Returns the next symbol, or -1 for a code that isn't in the table. Needs at least 16 buffered bits.
+    int Decode(BitReader &bits) const {
+        if (uint16_t fast = mFast[bits.Peek(fastBits)]) {
+            bits.Consume(fast >> 8);
+            return fast & 0xFF;
+        }
+        for (int len = fastBits + 1; len <= 16; ++len) {
+            auto code = static_cast<int>(bits.Peek(len));
+            if (code <= mMaxCode[len]) {
+                bits.Consume(len);
+                return mSymbols[mOffset[len] + code];
+            }
+        }
+        return -1;
+    }
+
+  private:
+    std::array<uint16_t, 1 << fastBits> mFast{};
+    std::array<int, 17> mMaxCode{};
+    std::array<int, 17> mOffset{};
+    std::vector<byte> mSymbols;
+    bool mValid = false;
+};
+
+// Inverse DCT basis for 1, 2, 4 and 8 outputs from as many coefficients, scaled so that a flat block decodes to its DC
+// coefficient over 8 whatever the output size: basis[log2 n][x][u] = C(u) / 2 * cos((2x + 1) u pi / 2n).
+struct IdctBasis {
+    IdctBasis() {
+        for (int level = 0, n = 1; level < 4; ++level, n *= 2) {
+            for (int x = 0; x < n; ++x) {
+                for (int u = 0; u < n; ++u) {
+                    double c = u == 0 ? std::sqrt(0.5) : 1.0;
+                    table[level][x][u] =
+                        static_cast<float>(c / 2 * std::cos((2 * x + 1) * u * std::numbers::pi / (2 * n)));
+                }
+            }
+        }
+    }
+
+    float table[4][8][8] = {};
+};
+
+int Log2(int n) { return n >= 8 ? 3 : n >= 4 ? 2 : n >= 2 ? 1 : 0; }
+
+byte Clamp(int v) { return static_cast<byte>(std::clamp(v, 0, 255)); }
+
+// Inverse transforms the low nx by ny coefficients of a block into nx by ny pixels. Only the first cols columns and
+// rows rows of coefficients can be nonzero, which is usually far fewer than 8 and cuts most of the work.
+void InverseDct(const int32_t *coef, int cols, int rows, int nx, int ny, byte *out, std::size_t stride) {
+    cols = std::min(cols, nx);
+    rows = std::min(rows, ny);
+    if (cols == 1 && rows == 1) {
+        byte v = Clamp((coef[0] + 1028) >> 3);
+        for (int y = 0; y < ny; ++y) {
+            std::memset(out + y * stride, v, static_cast<std::size_t>(nx));
+        }
+        return;
+    }
+
+    static const IdctBasis basis;
+    const auto &bx = basis.table[Log2(nx)];
+    const auto &by = basis.table[Log2(ny)];
+
+    // Columns first, then rows.
+    float tmp[8][8];
+    for (int u = 0; u < cols; ++u) {
+        float c[8];
+        for (int v = 0; v < rows; ++v) {
+            c[v] = static_cast<float>(coef[v * 8 + u]);
+        }
+        for (int y = 0; y < ny; ++y) {
+            float sum = 0;
+            for (int v = 0; v < rows; ++v) {
+                sum += c[v] * by[y][v];
+            }
+            tmp[y][u] = sum;
+        }
+    }
+    for (int y = 0; y < ny; ++y) {
+        byte *row = out + y * stride;
+        for (int x = 0; x < nx; ++x) {
+            float sum = 128.5f;
+            for (int u = 0; u < cols; ++u) {
+                sum += tmp[y][u] * bx[x][u];
+            }
+            // Truncation only rounds the wrong way below zero, which the clamp takes care of.
+            row[x] = Clamp(static_cast<int>(sum));
+        }
+    }
+}
+
+struct Component {
+    int id = 0;
+    int h = 0;
+    int v = 0;
+    int quant = 0;
+    int dcTable = 0;
+    int acTable = 0;
+    int pred = 0;
+    // Output size of each block, and the power of two the plane is upsampled by on top to reach the output size.
+    int nx = 8;
+    int ny = 8;
+    int upShiftX = 0;
+    int upShiftY = 0;
+    std::vector<byte> plane;
+    std::size_t stride = 0;
+};
+
+class Decoder {
+  public:
+    Decoder(const byte *file, std::size_t size) : mData(file), mEnd(file + size) {}
+
+    bool Decode(int scale, bool redOnly, std::vector<byte> &pixels, int &width, int &height, int &channels) {
+        const byte *p = mData + 2;
+        while (p + 4 <= mEnd) {
+            if (*p != 0xFF) {
+                return false;
+            }
+            byte marker = p[1];
+            if (marker == 0xFF) {
+                ++p;
+                continue;
+            }
+            if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+                p += 2;
+                continue;
+            }
+            std::size_t length = ReadBE16(p + 2);
+            if (length < 2 || p + 2 + length > mEnd) {
+                return false;
+            }
+            const byte *seg = p + 4;
+            const byte *segEnd = p + 2 + length;
+
+            bool ok = true;
+            switch (marker) {
+            case 0xDB:
+                ok = ReadQuantTables(seg, segEnd);
+                break;
+            case 0xC4:
+                ok = ReadHuffmanTables(seg, segEnd);
+                break;
+            case 0xC0:
+            case 0xC1:
+                ok = ReadFrame(seg, segEnd);
+                break;
+            case 0xDD:
+                ok = segEnd - seg >= 2;
+                mRestartInterval = ok ? ReadBE16(seg) : 0;
+                break;
+            case 0xEE:
+                // Adobe's marker; transform 0 means the components are RGB rather than YCbCr.
+                if (segEnd - seg >= 12 && std::memcmp(seg, "Adobe", 5) == 0 && seg[11] == 0) {
+                    mAdobeRgb = true;
+                }
+                break;
+            case 0xDA:
+                return ReadScan(seg, segEnd) && DecodeScan(segEnd, scale, redOnly) &&
+                       Output(scale, redOnly, pixels, width, height, channels);
+            case 0xD9:
+                return false;
+            default:
+                // Progressive, lossless, hierarchical and arithmetic coded frames.
+                if (marker >= 0xC2 && marker <= 0xCF) {
+                    return false;
+                }
+                break;
+            }
+            if (!ok) {
+                return false;
+            }
+            p = segEnd;
+        }
+        return false;
+    }
+
+  private:
+    bool ReadQuantTables(const byte *p, const byte *end) {
+        while (p < end) {
+            int precision = p[0] >> 4;
+            int id = p[0] & 15;
+            std::size_t size = precision ? 128 : 64;
+            if (id > 3 || precision > 1 || static_cast<std::size_t>(end - p - 1) < size) {
+                return false;
+            }
+            for (int i = 0; i < 64; ++i) {
+                mQuant[id][i] = precision ? ReadBE16(p + 1 + 2 * i) : p[1 + i];
+            }
+            p += 1 + size;
+        }
+        return true;
+    }
+
+    bool ReadHuffmanTables(const byte *p, const byte *end) {
+        while (p < end) {
+            if (end - p < 17) {
+                return false;
+            }
+            int tableClass = p[0] >> 4;
+            int id = p[0] & 15;
+            int count = 0;
+            for (int i = 0; i < 16; ++i) {
+                count += p[1 + i];
+            }
+            if (tableClass > 1 || id > 3 || count > 256 || end - p - 17 < count) {
+                return false;
+            }
+            auto &table = tableClass ? mAc[id] : mDc[id];
+            if (!table.Build(p + 1, p + 17, count)) {
+                return false;
+            }
+            p += 17 + count;
+        }
+        return true;
+    }
+
+    bool ReadFrame(const byte *p, const byte *end) {
+        if (end - p < 6 || p[0] != 8 || !mComponents.empty()) {
+            return false;
+        }
+        mHeight = ReadBE16(p + 1);
+        mWidth = ReadBE16(p + 3);
+        int count = p[5];
+        if (mWidth == 0 || mHeight == 0 || (count != 1 && count != 3) || end - p < 6 + 3 * count) {
+            return false;
+        }
+        for (int i = 0; i < count; ++i) {
+            const byte *c = p + 6 + 3 * i;
+            Component comp;
+            comp.id = c[0];
+            comp.h = c[1] >> 4;
+            comp.v = c[1] & 15;
+            comp.quant = c[2];
+            if (comp.h < 1 || comp.h > 4 || comp.v < 1 || comp.v > 4 || comp.quant > 3) {
+                return false;
+            }
+            mComponents.push_back(comp);
+        }
+        if (count == 1) {
+            // A single component is never interleaved, so its sampling factors don't matter.
+            mComponents[0].h = mComponents[0].v = 1;
+        }
+        for (const auto &comp : mComponents) {
+            mMaxH = std::max(mMaxH, comp.h);
+            mMaxV = std::max(mMaxV, comp.v);
+        }
+        for (const auto &comp : mComponents) {
+            // Only power of two subsampling maps to whole block sizes.
+            if (!std::has_single_bit(static_cast<unsigned>(mMaxH / comp.h)) || mMaxH % comp.h ||
+                !std::has_single_bit(static_cast<unsigned>(mMaxV / comp.v)) || mMaxV % comp.v) {
+                return false;
+            }
+        }
+        return !(count == 3 && (mAdobeRgb || (mComponents[0].id == 'R' && mComponents[1].id == 'G')));
+    }
+
+    bool ReadScan(const byte *p, const byte *end) {
+        if (mComponents.empty() || end - p < 1) {
+            return false;
+        }
+        // Every component in this one scan, in frame order; anything else needs several scans.
+        int count = p[0];
+        if (count != static_cast<int>(mComponents.size()) || end - p < 1 + 2 * count + 3) {
+            return false;
+        }
+        for (int i = 0; i < count; ++i) {
+            auto &comp = mComponents[i];
+            if (p[1 + 2 * i] != comp.id) {
+                return false;
+            }
+            comp.dcTable = p[2 + 2 * i] >> 4;
+            comp.acTable = p[2 + 2 * i] & 15;
+            if (comp.dcTable > 3 || comp.acTable > 3 || !mDc[comp.dcTable].Valid() || !mAc[comp.acTable].Valid()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool DecodeScan(const byte *data, int scale, bool redOnly) {
+        int mcuW = 8 * mMaxH;
+        int mcuH = 8 * mMaxV;
+        int mcusX = (mWidth + mcuW - 1) / mcuW;
+        int mcusY = (mHeight + mcuH - 1) / mcuH;
+        int n = 8 / scale;
+        for (std::size_t c = 0; c < mComponents.size(); ++c) {
+            auto &comp = mComponents[c];
+            comp.nx = n * mMaxH / comp.h;
+            comp.ny = n * mMaxV / comp.v;
+            comp.upShiftX = std::countr_zero(static_cast<unsigned>(std::max(comp.nx / 8, 1)));
+            comp.upShiftY = std::countr_zero(static_cast<unsigned>(std::max(comp.ny / 8, 1)));
+            comp.nx >>= comp.upShiftX;
+            comp.ny >>= comp.upShiftY;
+            if (c != 1 || !redOnly) {
+                comp.stride = static_cast<std::size_t>(mcusX) * comp.h * comp.nx;
+                comp.plane.resize(comp.stride * mcusY * comp.v * comp.ny);
+            }
+        }
+
+        BitReader bits(data, mEnd);
+        alignas(16) int32_t coef[64];
+        for (int my = 0, mcu = 0; my < mcusY; ++my) {
+            for (int mx = 0; mx < mcusX; ++mx, ++mcu) {
+                if (mRestartInterval && mcu > 0 && mcu % mRestartInterval == 0) {
+                    if (!bits.Restart()) {
+                        return false;
+                    }
+                    for (auto &comp : mComponents) {
+                        comp.pred = 0;
+                    }
+                }
+                for (auto &comp : mComponents) {
+                    for (int by = 0; by < comp.v; ++by) {
+                        for (int bx = 0; bx < comp.h; ++bx) {
+                            int cols = 1;
+                            int rows = 1;
+                            if (!DecodeBlock(bits, comp, coef, cols, rows)) {
+                                return false;
+                            }
+                            if (!comp.plane.empty()) {
+                                std::size_t x = static_cast<std::size_t>(mx * comp.h + bx) * comp.nx;
+                                std::size_t y = static_cast<std::size_t>(my * comp.v + by) * comp.ny;
+                                InverseDct(coef, cols, rows, comp.nx, comp.ny, comp.plane.data() + y * comp.stride + x,
+                                           comp.stride);
+                            }
+                        }
+                    }
+                }
+                if (bits.Overrun()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Entropy decodes and dequantizes one block into natural order. cols and rows grow to cover every coefficient
+    // coded.
+    bool DecodeBlock(BitReader &bits, Component &comp, int32_t *coef, int &cols, int &rows) const {
+        const auto &dc = mDc[comp.dcTable];
+        const auto &ac = mAc[comp.acTable];
+        const auto &quant = mQuant[comp.quant];
+
+        std::memset(coef, 0, 64 * sizeof(int32_t));
+        bits.Refill();
+        int size = dc.Decode(bits);
+        if (size < 0 || size > maxDcBits) {
+            return false;
+        }
+        comp.pred += bits.ReadSigned(size);
+        if (comp.pred < -maxDc || comp.pred > maxDc) {
+            return false;
+        }
+        coef[0] = comp.pred * quant[0];
+
+        for (int k = 1; k < 64;) {
+            bits.Refill();
+            int rs = ac.Decode(bits);
+            if (rs < 0) {
+                return false;
+            }
+            int run = rs >> 4;
+            int s = rs & 15;
+            if (s == 0) {
+                if (run != 15) {
+                    break;
+                }
+                k += 16;
+                continue;
+            }
+            k += run;
+            if (k > 63 || s > maxAcBits) {
+                return false;
+            }
+            int pos = zigzag[k];
+            coef[pos] = bits.ReadSigned(s) * quant[k++];
+            cols = std::max(cols, (pos & 7) + 1);
+            rows = std::max(rows, (pos >> 3) + 1);
+        }
+        return true;
+    }
+
+    bool Output(int scale, bool redOnly, std::vector<byte> &pixels, int &width, int &height, int &channels) const {
+        width = (mWidth + scale - 1) / scale;
+        height = (mHeight + scale - 1) / scale;
+        bool color = mComponents.size() == 3;
+        channels = color && !redOnly ? 3 : 1;
+        pixels.resize(static_cast<std::size_t>(width) * height * channels);
+
+        const auto &luma = mComponents[0];
+        if (!color) {
+            for (int y = 0; y < height; ++y) {
+                std::memcpy(pixels.data() + static_cast<std::size_t>(y) * width,
+                            luma.plane.data() + (y >> luma.upShiftY) * luma.stride, static_cast<std::size_t>(width));
+            }
+            return true;
+        }
+
+        // JFIF YCbCr to RGB in 16-bit fixed point.
+        const auto &cb = mComponents[1];
+        const auto &cr = mComponents[2];
+        if (redOnly) {
+            for (int y = 0; y < height; ++y) {
+                const byte *yRow = luma.plane.data() + (y >> luma.upShiftY) * luma.stride;
+                const byte *crRow = cr.plane.data() + (y >> cr.upShiftY) * cr.stride;
+                byte *out = pixels.data() + static_cast<std::size_t>(y) * width;
+                for (int x = 0; x < width; ++x) {
+                    out[x] = Clamp(((yRow[x] << 16) + 91881 * (crRow[x >> cr.upShiftX] - 128) + 32768) >> 16);
+                }
+            }
+            return true;
+        }
+        for (int y = 0; y < height; ++y) {
+            const byte *yRow = luma.plane.data() + (y >> luma.upShiftY) * luma.stride;
+            const byte *cbRow = cb.plane.data() + (y >> cb.upShiftY) * cb.stride;
+            const byte *crRow = cr.plane.data() + (y >> cr.upShiftY) * cr.stride;
+            byte *out = pixels.data() + static_cast<std::size_t>(y) * width * 3;
+            for (int x = 0; x < width; ++x) {
+                int yy = yRow[x] << 16;
+                int u = cbRow[x >> cb.upShiftX] - 128;
+                int v = crRow[x >> cr.upShiftX] - 128;
+                out[3 * x] = Clamp((yy + 91881 * v + 32768) >> 16);
+                out[3 * x + 1] = Clamp((yy - 22554 * u - 46802 * v + 32768) >> 16);
+                out[3 * x + 2] = Clamp((yy + 116130 * u + 32768) >> 16);
+            }
+        }
+        return true;
+    }
+
+    const byte *mData;
+    const byte *mEnd;
+    std::array<std::array<uint16_t, 64>, 4> mQuant{};
+    std::array<Huffman, 4> mDc;
+    std::array<Huffman, 4> mAc;
+    std::vector<Component> mComponents;
+    int mWidth = 0;
+    int mHeight = 0;
+    int mMaxH = 1;
+    int mMaxV = 1;
+    int mRestartInterval = 0;
+    bool mAdobeRgb = false;
+};
+} // namespace
+
+bool IsJpeg(const byte *file, std::size_t size) {
+    return size >= 3 && file[0] == 0xFF && file[1] == 0xD8 && file[2] == 0xFF;
+}
+
+bool DecodeJpeg(const byte *file, std::size_t size, int scale, bool redOnly, std::vector<byte> &pixels, int &width,
+                int &height, int &channels) {
+    if (!IsJpeg(file, size) || (scale != 1 && scale != 2 && scale != 4 && scale != 8)) {
+        return false;
+    }
+    return Decoder(file, size).Decode(scale, redOnly, pixels, width, height, channels);
+}
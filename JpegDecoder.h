@@ -0,0 +1,25 @@
+#ifndef JPEGDECODER_H
+#define JPEGDECODER_H
+
+#include "Image.h"
+
+#include <cstddef>
+#include <vector>
+
+// Whether the file starts with a JPEG start of image marker.
+bool IsJpeg(const byte *file, std::size_t size);
+
+// Decoder for baseline JPEGs: 8-bit, Huffman coded, every component in one scan, grayscale or YCbCr with chroma
+// subsampled by 1, 2 or 4 in either direction.
+//
+// scale (1, 2, 4 or 8) divides the output dimensions, rounding up. Each block is inverse transformed from its low
+// frequency coefficients straight to 8 / scale pixels a side, so a scaled decode does less work rather than more, and
+// subsampled chroma comes out at the size it's needed without upsampling. With redOnly the result has one channel,
+// the red a full decode would have, and the Cb blocks are only entropy decoded. Chroma that still needs upsampling is
+// replicated.
+//
+// Returns false for anything else, including progressive and corrupt files, so the caller can fall back to stb_image.
+bool DecodeJpeg(const byte *file, std::size_t size, int scale, bool redOnly, std::vector<byte> &pixels, int &width,
+                int &height, int &channels);
+
+#endif
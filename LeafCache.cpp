@@ -0,0 +1,28 @@
+#include "LeafCache.h"
+
+#include <mutex>
+
+LeafCache::LeafCache(Image leafImage) : mLeafImage(std::move(leafImage)) {}
+
+const Image &LeafCache::Get(int w, int h) {
+    auto size = std::make_pair(w, h);
+
+    {
+        std::shared_lock lock(*mCacheMutex);
+        auto it = mLeafCache.find(size);
+        if (it != mLeafCache.end())
+            return it->second;
+    }
+
+    {
+        // Possible for multiple threads to get here just not simultaneously; ultimately this would be fine but would do
+        // extra work by doing redundant resizing which gets discarded, so we're going to do a find again.
+        // An alternative is to use call_once, but that would require an extra map of once_flag.
+        std::unique_lock lock(*mCacheMutex);
+        auto it = mLeafCache.find(size);
+        if (it == mLeafCache.end()) {
+            it = mLeafCache.emplace(size, mLeafImage.resizeFastNew(size.first, size.second)).first;
+        }
+        return it->second;
+    }
+}
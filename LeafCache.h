@@ -0,0 +1,26 @@
+#ifndef LEAFCACHE_H
+#define LEAFCACHE_H
+
+#include "Image.h"
+
+#include <map>
+#include <memory>
+#include <shared_mutex>
+
+// A sprite together with its resized copies, built on demand for each leaf size and shared between threads.
+class LeafCache {
+  public:
+    explicit LeafCache(Image leafImage);
+
+    const Image &GetImage() const { return mLeafImage; }
+
+    const Image &Get(int w, int h);
+
+  private:
+    std::unique_ptr<std::shared_mutex> mCacheMutex = std::make_unique<std::shared_mutex>();
+
+    std::map<std::pair<int, int>, Image> mLeafCache;
+    Image mLeafImage;
+};
+
+#endif
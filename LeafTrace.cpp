@@ -0,0 +1,118 @@
+#include "LeafTrace.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+namespace {
+constexpr char Magic[8] = {'Q', 'T', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// Little endian, whatever the host is, so traces can be replayed on other machines.
+template <class T> void Put(std::vector<byte> &out, T value) {
+    auto v = static_cast<uint32_t>(value);
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<byte>(v >> (8 * i)));
+    }
+}
+
+class Reader {
+  public:
+    Reader(const std::vector<byte> &data, std::size_t pos) : mData(data), mPos(pos) {}
+
+    bool Has(std::size_t size) const { return mData.size() - mPos >= size; }
+
+    template <class T> T Get() {
+        uint32_t v = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i) {
+            v |= static_cast<uint32_t>(mData[mPos++]) << (8 * i);
+        }
+        return static_cast<T>(v);
+    }
+
+  private:
+    const std::vector<byte> &mData;
+    std::size_t mPos;
+};
+
+constexpr std::size_t HeaderSize = sizeof(Magic) + 3 + 1 + 4;
+constexpr std::size_t FrameHeaderSize = 7 * 4;
+constexpr std::size_t LeafSize = 4 * 2 + 3 + 2;
+} // namespace
+
+LeafTraceWriter::LeafTraceWriter(const std::string &path, const QuadtreeParameters &params)
+    : mFile(path, std::ios::binary) {
+    std::vector<byte> header(std::begin(Magic), std::end(Magic));
+    Put<uint8_t>(header, params.background.r);
+    Put<uint8_t>(header, params.background.g);
+    Put<uint8_t>(header, params.background.b);
+    Put<uint8_t>(header, (params.phaseOffsets ? 1 : 0) | (params.mipSprites ? 2 : 0) | (params.fieldSprites ? 4 : 0));
+    Put<int32_t>(header, params.minSize);
+    mFile.write(reinterpret_cast<const char *>(header.data()), static_cast<std::streamsize>(header.size()));
+}
+
+void LeafTraceWriter::Write(const TracedFrame &frame) {
+    // Serialized outside the lock; only the file write is shared.
+    std::vector<byte> record;
+    record.reserve(FrameHeaderSize + frame.leaves.size() * LeafSize);
+    for (int v : {frame.index, frame.phase, frame.variant, frame.width, frame.height, frame.channels}) {
+        Put<int32_t>(record, v);
+    }
+    Put<uint32_t>(record, frame.leaves.size());
+    for (const auto &leaf : frame.leaves) {
+        for (int v : {leaf.bounds.x, leaf.bounds.y, leaf.bounds.w, leaf.bounds.h}) {
+            Put<uint16_t>(record, v);
+        }
+        Put<uint8_t>(record, leaf.color.r);
+        Put<uint8_t>(record, leaf.color.g);
+        Put<uint8_t>(record, leaf.color.b);
+        Put<int16_t>(record, leaf.sprite);
+    }
+
+    std::unique_lock lock(mMutex);
+    mFile.write(reinterpret_cast<const char *>(record.data()), static_cast<std::streamsize>(record.size()));
+}
+
+bool ReadLeafTrace(const std::string &path, QuadtreeParameters &params, std::vector<TracedFrame> &frames) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<byte> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < HeaderSize || std::memcmp(data.data(), Magic, sizeof(Magic)) != 0) {
+        return false;
+    }
+
+    Reader in(data, sizeof(Magic));
+    params.background.r = in.Get<uint8_t>();
+    params.background.g = in.Get<uint8_t>();
+    params.background.b = in.Get<uint8_t>();
+    auto flags = in.Get<uint8_t>();
+    params.phaseOffsets = (flags & 1) != 0;
+    params.mipSprites = (flags & 2) != 0;
+    params.fieldSprites = (flags & 4) != 0;
+    params.minSize = in.Get<int32_t>();
+
+    while (in.Has(FrameHeaderSize)) {
+        TracedFrame frame;
+        frame.index = in.Get<int32_t>();
+        frame.phase = in.Get<int32_t>();
+        frame.variant = in.Get<int32_t>();
+        frame.width = in.Get<int32_t>();
+        frame.height = in.Get<int32_t>();
+        frame.channels = in.Get<int32_t>();
+        auto count = in.Get<uint32_t>();
+        if (!in.Has(static_cast<std::size_t>(count) * LeafSize)) {
+            break;
+        }
+        frame.leaves.resize(count);
+        for (auto &leaf : frame.leaves) {
+            leaf.bounds.x = in.Get<uint16_t>();
+            leaf.bounds.y = in.Get<uint16_t>();
+            leaf.bounds.w = in.Get<uint16_t>();
+            leaf.bounds.h = in.Get<uint16_t>();
+            leaf.color.r = in.Get<uint8_t>();
+            leaf.color.g = in.Get<uint8_t>();
+            leaf.color.b = in.Get<uint8_t>();
+            leaf.sprite = in.Get<int16_t>();
+        }
+        frames.push_back(std::move(frame));
+    }
+    return true;
+}
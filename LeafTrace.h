@@ -0,0 +1,41 @@
+#ifndef LEAFTRACE_H
+#define LEAFTRACE_H
+
+#include "Quadtree.h"
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One rendered frame of a trace: everything Quadtree::Render needs apart from the sprites.
+struct TracedFrame {
+    int index;
+    int phase;
+    // Which of the variants rendered from the same input this is, 0 for the main output.
+    int variant;
+    int width;
+    int height;
+    int channels;
+    Quadtree::LeafList leaves;
+};
+
+// Records the leaf lists of real jobs, so rendering can be benchmarked on their leaf size distribution without the
+// input frames. Frames can be written from any thread; they are stored in the order they arrive, 13 bytes per leaf.
+class LeafTraceWriter {
+  public:
+    // The parameters that affect rendering are stored with the trace.
+    LeafTraceWriter(const std::string &path, const QuadtreeParameters &params);
+
+    void Write(const TracedFrame &frame);
+
+  private:
+    std::mutex mMutex;
+    std::ofstream mFile;
+};
+
+// Reads a trace written by LeafTraceWriter. Returns false if the file can't be read or isn't a trace; a trace cut short
+// keeps the frames before the cut.
+bool ReadLeafTrace(const std::string &path, QuadtreeParameters &params, std::vector<TracedFrame> &frames);
+
+#endif
@@ -0,0 +1,588 @@
+#include "PngDecoder.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PNGDECODER_SSE2
+#endif
+
+namespace {
+uint32_t ReadBE32(const byte *p) {
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[2]) << 8 |
+           p[3];
+}
+
+// Deflate streams are read least significant bit first, so whole little-endian words can be shifted in at once.
+class BitReader {
+  public:
+    BitReader(const byte *data, std::size_t size) : mPos(data), mEnd(data + size) {}
+
+    // Buffers at least 56 bits. Past the end of the input zeros are shifted in, which Overrun() reports once used.
+    // Bits above mCount always hold the upcoming input or zeros, so rereading a byte that's partly buffered is fine.
+    void Refill() {
+        if constexpr (std::endian::native == std::endian::little) {
+            if (mEnd - mPos >= 8) {
+                uint64_t word;
+                std::memcpy(&word, mPos, sizeof(word));
+                mBits |= word << mCount;
+                mPos += (63 - mCount) >> 3;
+                mCount |= 56;
+                return;
+            }
+        }
+        while (mCount < 56) {
+            if (mPos < mEnd) {
+                mBits |= static_cast<uint64_t>(*mPos++) << mCount;
+            } else {
+                mPastEnd += 8;
+            }
+            mCount += 8;
+        }
+    }
+
+    uint32_t Peek(int n) const { return static_cast<uint32_t>(mBits & ((uint64_t{1} << n) - 1)); }
+
+    void Consume(int n) {
+        mBits >>= n;
+        mCount -= n;
+    }
+
+    uint32_t Read(int n) {
+        uint32_t value = Peek(n);
+        Consume(n);
+        return value;
+    }
+
+    void AlignToByte() { Consume(mCount % 8); }
+
+    // Copies raw bytes, as stored blocks need. Only valid right after AlignToByte().
+    bool CopyBytes(byte *dst, std::size_t size) {
+        for (; size && mCount >= 8; --size) {
+            *dst++ = static_cast<byte>(Read(8));
+        }
+        if (size == 0) {
+            return true;
+        }
+        if (mPastEnd || static_cast<std::size_t>(mEnd - mPos) < size) {
+            return false;
+        }
+        std::memcpy(dst, mPos, size);
+        mPos += size;
+        mBits = 0;
+        mCount = 0;
+        return true;
+    }
+
+    bool Overrun() const { return mPastEnd > mCount; }
+
+  private:
+    const byte *mPos;
+    const byte *mEnd;
+    uint64_t mBits = 0;
+    int mCount = 0;
+    int mPastEnd = 0;
+};
+
+constexpr int maxCodeLength = 15;
+constexpr int fastBits = 10;
+
+// Canonical Huffman code. Codes of up to fastBits bits are a single lookup, longer ones are walked length by length.
+class Huffman {
+  public:
+    bool Build(const byte *lengths, int count) {
+        mCounts.fill(0);
+        for (int i = 0; i < count; ++i) {
+            ++mCounts[lengths[i]];
+        }
+        mCounts[0] = 0;
+
+        int left = 1;
+        std::array<uint16_t, maxCodeLength + 2> offsets{};
+        for (int len = 1; len <= maxCodeLength; ++len) {
+            left = (left << 1) - mCounts[len];
+            if (left < 0) {
+                return false;
+            }
+            offsets[len + 1] = static_cast<uint16_t>(offsets[len] + mCounts[len]);
+        }
+
+        std::array<uint16_t, maxCodeLength + 1> nextCode{};
+        for (int len = 1, code = 0; len <= maxCodeLength; ++len) {
+            code = (code + mCounts[len - 1]) << 1;
+            nextCode[len] = static_cast<uint16_t>(code);
+        }
+
+        mFast.fill(0);
+        for (int sym = 0; sym < count; ++sym) {
+            int len = lengths[sym];
+            if (len == 0) {
+                continue;
+            }
+            mSymbols[offsets[len]++] = static_cast<uint16_t>(sym);
+
+            int code = nextCode[len]++;
+            if (len <= fastBits) {
+                int reversed = 0;
+                for (int i = 0; i < len; ++i) {
+                    reversed |= (code >> i & 1) << (len - 1 - i);
+                }
+                for (int i = reversed; i < (1 << fastBits); i += 1 << len) {
+                    mFast[i] = static_cast<uint16_t>(sym << 4 | len);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Needs at least maxCodeLength bits buffered. Returns -1 for bits that aren't a code.
+    int Decode(BitReader &bits) const {
+        if (uint16_t entry = mFast[bits.Peek(fastBits)]) {
+            bits.Consume(entry & 15);
+            return entry >> 4;
+        }
+
+        uint32_t buffered = bits.Peek(maxCodeLength);
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int len = 1; len <= maxCodeLength; ++len) {
+            code |= buffered & 1;
+            buffered >>= 1;
+            int count = mCounts[len];
+            if (code - first < count) {
+                bits.Consume(len);
+                return mSymbols[index + code - first];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+  private:
+    // Symbol << 4 | code length, or 0 for codes longer than fastBits.
+    std::array<uint16_t, 1 << fastBits> mFast;
+    std::array<uint16_t, maxCodeLength + 1> mCounts;
+    // Symbols in code order.
+    std::array<uint16_t, 288> mSymbols;
+};
+
+constexpr std::array<uint16_t, 29> lengthBase = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::array<byte, 29> lengthExtra = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                              2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::array<uint16_t, 30> distBase = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,
+                                               33,  49,  65,  97,  129, 193,  257,  385,  513,  769,
+                                               1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr std::array<byte, 30> distExtra = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                            6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+bool InflateBlock(BitReader &bits, const Huffman &lit, const Huffman &dist, byte *out, std::size_t outSize,
+                  std::size_t &pos) {
+    for (;;) {
+        // The longest symbol is a 15 bit length code with 5 extra bits and a 15 bit distance code with 13 extra bits,
+        // which fits in one refill.
+        bits.Refill();
+        int sym = lit.Decode(bits);
+        if (sym < 256) {
+            if (sym < 0 || pos >= outSize) {
+                return false;
+            }
+            out[pos++] = static_cast<byte>(sym);
+            continue;
+        }
+        if (sym == 256) {
+            return true;
+        }
+
+        sym -= 257;
+        if (sym >= static_cast<int>(lengthBase.size())) {
+            return false;
+        }
+        std::size_t len = lengthBase[sym] + bits.Read(lengthExtra[sym]);
+        int d = dist.Decode(bits);
+        if (d < 0 || d >= static_cast<int>(distBase.size())) {
+            return false;
+        }
+        std::size_t distance = distBase[d] + bits.Read(distExtra[d]);
+        if (distance > pos || len > outSize - pos) {
+            return false;
+        }
+
+        byte *dst = out + pos;
+        const byte *src = dst - distance;
+        pos += len;
+        if (distance >= len) {
+            std::memcpy(dst, src, len);
+        } else if (distance == 1) {
+            std::memset(dst, *src, len);
+        } else if (distance >= 8) {
+            // Each 8 byte step only reads bytes written before it.
+            std::size_t i = 0;
+            for (; i + 8 <= len; i += 8) {
+                std::memcpy(dst + i, src + i, 8);
+            }
+            for (; i < len; ++i) {
+                dst[i] = src[i];
+            }
+        } else {
+            for (std::size_t i = 0; i < len; ++i) {
+                dst[i] = src[i];
+            }
+        }
+    }
+}
+
+// Inflates a zlib stream that must decompress to exactly outSize bytes. The Adler-32 trailer isn't checked.
+bool Inflate(const byte *data, std::size_t size, byte *out, std::size_t outSize) {
+    if (size < 2 || (data[0] & 15) != 8 || (data[0] << 8 | data[1]) % 31 != 0 || (data[1] & 32)) {
+        return false;
+    }
+
+    BitReader bits(data + 2, size - 2);
+    Huffman lit;
+    Huffman dist;
+    std::size_t pos = 0;
+    bool last = false;
+    while (!last) {
+        bits.Refill();
+        last = bits.Read(1);
+        int type = static_cast<int>(bits.Read(2));
+        if (type == 0) {
+            bits.AlignToByte();
+            uint32_t len = bits.Read(16);
+            uint32_t nlen = bits.Read(16);
+            if (len != (~nlen & 0xffff) || len > outSize - pos || !bits.CopyBytes(out + pos, len)) {
+                return false;
+            }
+            pos += len;
+            continue;
+        }
+
+        std::array<byte, 288 + 32> lengths{};
+        int litCount;
+        int distCount;
+        if (type == 1) {
+            litCount = 288;
+            distCount = 32;
+            std::fill(lengths.begin(), lengths.begin() + 144, 8);
+            std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+            std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+            std::fill(lengths.begin() + 280, lengths.begin() + 288, 8);
+            std::fill(lengths.begin() + 288, lengths.end(), 5);
+        } else if (type == 2) {
+            static constexpr std::array<byte, 19> order = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                                           11, 4,  12, 3, 13, 2, 14, 1, 15};
+            litCount = static_cast<int>(bits.Read(5)) + 257;
+            distCount = static_cast<int>(bits.Read(5)) + 1;
+            int codeCount = static_cast<int>(bits.Read(4)) + 4;
+            std::array<byte, 19> codeLengths{};
+            for (int i = 0; i < codeCount; ++i) {
+                bits.Refill();
+                codeLengths[order[i]] = static_cast<byte>(bits.Read(3));
+            }
+            Huffman lengthCode;
+            if (!lengthCode.Build(codeLengths.data(), static_cast<int>(codeLengths.size()))) {
+                return false;
+            }
+
+            int total = litCount + distCount;
+            for (int n = 0; n < total;) {
+                bits.Refill();
+                int sym = lengthCode.Decode(bits);
+                if (sym < 0) {
+                    return false;
+                }
+                if (sym < 16) {
+                    lengths[n++] = static_cast<byte>(sym);
+                    continue;
+                }
+                byte value = 0;
+                int repeat;
+                if (sym == 16) {
+                    if (n == 0) {
+                        return false;
+                    }
+                    value = lengths[n - 1];
+                    repeat = 3 + static_cast<int>(bits.Read(2));
+                } else if (sym == 17) {
+                    repeat = 3 + static_cast<int>(bits.Read(3));
+                } else {
+                    repeat = 11 + static_cast<int>(bits.Read(7));
+                }
+                if (n + repeat > total) {
+                    return false;
+                }
+                std::fill(lengths.begin() + n, lengths.begin() + n + repeat, value);
+                n += repeat;
+            }
+            if (lengths[256] == 0) {
+                return false;
+            }
+            // Distance lengths follow the literal/length ones directly.
+            std::copy(lengths.begin() + litCount, lengths.begin() + total, lengths.begin() + 288);
+            std::fill(lengths.begin() + litCount, lengths.begin() + 288, 0);
+        } else {
+            return false;
+        }
+
+        if (!lit.Build(lengths.data(), litCount) || !dist.Build(lengths.data() + 288, distCount) ||
+            !InflateBlock(bits, lit, dist, out, outSize, pos) || bits.Overrun()) {
+            return false;
+        }
+    }
+    return !bits.Overrun() && pos == outSize;
+}
+
+byte Paeth(int a, int b, int c) {
+    int pa = std::abs(b - c);
+    int pb = std::abs(a - c);
+    int pc = std::abs(a + b - 2 * c);
+    if (pa <= pb && pa <= pc) {
+        return static_cast<byte>(a);
+    }
+    return static_cast<byte>(pb <= pc ? b : c);
+}
+
+#ifdef PNGDECODER_SSE2
+// A pixel in the low lanes of a register. Whole 4 byte words are moved even for 3 byte pixels: the extra lane is
+// ignored on the way in, and on the way out it lands where the next pixel is about to be written anyway.
+__m128i LoadPixel(const byte *p) {
+    int32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return _mm_cvtsi32_si128(v);
+}
+
+void StorePixel(byte *p, __m128i v) {
+    int32_t x = _mm_cvtsi128_si32(v);
+    std::memcpy(p, &x, sizeof(x));
+}
+
+// Sub, Avg and Paeth depend on the pixel to the left, so they go one pixel at a time with all of its channels in one
+// register. They stop short of the last 3 byte pixel, whose word would run past the row, and return where they did.
+std::size_t UnfilterSubSse2(byte *dst, const byte *src, std::size_t n, int bpp) {
+    __m128i a = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += bpp) {
+        a = _mm_add_epi8(a, LoadPixel(src + i));
+        StorePixel(dst + i, a);
+    }
+    return i;
+}
+
+std::size_t UnfilterAvgSse2(byte *dst, const byte *src, const byte *prev, std::size_t n, int bpp) {
+    // _mm_avg_epu8 rounds up where the filter rounds down.
+    const __m128i ones = _mm_set1_epi8(1);
+    __m128i a = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += bpp) {
+        __m128i b = LoadPixel(prev + i);
+        __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), ones));
+        a = _mm_add_epi8(LoadPixel(src + i), avg);
+        StorePixel(dst + i, a);
+    }
+    return i;
+}
+
+std::size_t UnfilterPaethSse2(byte *dst, const byte *src, const byte *prev, std::size_t n, int bpp) {
+    // Predictor arithmetic needs 9 bits plus sign, so channels are widened to 16 bits.
+    const __m128i zero = _mm_setzero_si128();
+    auto abs16 = [&](__m128i x) { return _mm_max_epi16(x, _mm_sub_epi16(zero, x)); };
+    auto select = [](__m128i mask, __m128i t, __m128i f) {
+        return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, f));
+    };
+
+    __m128i a = zero;
+    __m128i c = zero;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += bpp) {
+        __m128i b = _mm_unpacklo_epi8(LoadPixel(prev + i), zero);
+        __m128i x = _mm_unpacklo_epi8(LoadPixel(src + i), zero);
+
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = abs16(_mm_add_epi16(pa, pb));
+        pa = abs16(pa);
+        pb = abs16(pb);
+        __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        __m128i nearest = select(_mm_cmpeq_epi16(smallest, pa), a, select(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+        // Adding bytes keeps the sum modulo 256 in the low byte of each lane and the high byte zero.
+        a = _mm_add_epi8(x, nearest);
+        StorePixel(dst + i, _mm_packus_epi16(a, a));
+        c = b;
+    }
+    return i;
+}
+#endif
+
+// The scalar loops pick up wherever the SSE2 ones left off, which is the start of the row for 1 and 2 byte pixels.
+bool UnfilterRow(int type, byte *dst, const byte *src, const byte *prev, std::size_t n, int bpp) {
+    std::size_t i = 0;
+    auto first = static_cast<std::size_t>(bpp);
+    switch (type) {
+    case 0:
+        std::memcpy(dst, src, n);
+        return true;
+    case 1:
+#ifdef PNGDECODER_SSE2
+        if (bpp >= 3) {
+            i = UnfilterSubSse2(dst, src, n, bpp);
+        }
+#endif
+        for (; i < first; ++i) {
+            dst[i] = src[i];
+        }
+        for (; i < n; ++i) {
+            dst[i] = static_cast<byte>(src[i] + dst[i - bpp]);
+        }
+        return true;
+    case 2:
+#ifdef PNGDECODER_SSE2
+        for (; i + 16 <= n; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(prev + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_add_epi8(x, b));
+        }
+#endif
+        for (; i < n; ++i) {
+            dst[i] = static_cast<byte>(src[i] + prev[i]);
+        }
+        return true;
+    case 3:
+#ifdef PNGDECODER_SSE2
+        if (bpp >= 3) {
+            i = UnfilterAvgSse2(dst, src, prev, n, bpp);
+        }
+#endif
+        for (; i < first; ++i) {
+            dst[i] = static_cast<byte>(src[i] + (prev[i] >> 1));
+        }
+        for (; i < n; ++i) {
+            dst[i] = static_cast<byte>(src[i] + ((dst[i - bpp] + prev[i]) >> 1));
+        }
+        return true;
+    case 4:
+#ifdef PNGDECODER_SSE2
+        if (bpp >= 3) {
+            i = UnfilterPaethSse2(dst, src, prev, n, bpp);
+        }
+#endif
+        for (; i < first; ++i) {
+            dst[i] = static_cast<byte>(src[i] + prev[i]);
+        }
+        for (; i < n; ++i) {
+            dst[i] = static_cast<byte>(src[i] + Paeth(dst[i - bpp], prev[i], prev[i - bpp]));
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+} // namespace
+
+bool DecodePng(const byte *file, std::size_t size, std::vector<byte> &pixels, int &width, int &height, int &channels) {
+    static constexpr byte signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (size < sizeof(signature) || std::memcmp(file, signature, sizeof(signature)) != 0) {
+        return false;
+    }
+
+    uint32_t w = 0;
+    uint32_t h = 0;
+    int bpp = 0;
+    std::vector<std::pair<const byte *, std::size_t>> idat;
+    std::size_t idatSize = 0;
+    for (std::size_t pos = sizeof(signature); pos + 12 <= size;) {
+        uint32_t length = ReadBE32(file + pos);
+        const byte *type = file + pos + 4;
+        const byte *data = file + pos + 8;
+        if (length > size - pos - 12) {
+            return false;
+        }
+        pos += 12 + static_cast<std::size_t>(length);
+
+        if (std::memcmp(type, "IHDR", 4) == 0) {
+            // Bit depth 8, deflate, adaptive filtering, no interlacing.
+            if (length != 13 || bpp || data[8] != 8 || data[10] || data[11] || data[12]) {
+                return false;
+            }
+            switch (data[9]) {
+            case 0:
+                bpp = 1;
+                break;
+            case 2:
+                bpp = 3;
+                break;
+            case 4:
+                bpp = 2;
+                break;
+            case 6:
+                bpp = 4;
+                break;
+            default:
+                return false;
+            }
+            w = ReadBE32(data);
+            h = ReadBE32(data + 4);
+            // Same limit as stb_image.
+            if (w == 0 || h == 0 || w > (1u << 24) || h > (1u << 24)) {
+                return false;
+            }
+        } else if (std::memcmp(type, "IDAT", 4) == 0) {
+            if (!bpp) {
+                return false;
+            }
+            idat.emplace_back(data, length);
+            idatSize += length;
+        } else if (std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        } else if (std::memcmp(type, "tRNS", 4) == 0 || !(type[0] & 32)) {
+            // Transparency adds an alpha channel, and unknown critical chunks are stb_image's call.
+            return false;
+        }
+    }
+    if (!bpp || idat.empty()) {
+        return false;
+    }
+
+    // Frame dumps usually come with a single IDAT, which can be inflated in place.
+    std::vector<byte> joined;
+    const byte *compressed = idat[0].first;
+    if (idat.size() > 1) {
+        joined.reserve(idatSize);
+        for (auto [data, length] : idat) {
+            joined.insert(joined.end(), data, data + length);
+        }
+        compressed = joined.data();
+    }
+
+    std::size_t stride = static_cast<std::size_t>(w) * bpp;
+    std::vector<byte> filtered(static_cast<std::size_t>(h) * (stride + 1));
+    if (!Inflate(compressed, idatSize, filtered.data(), filtered.size())) {
+        return false;
+    }
+
+    pixels.resize(static_cast<std::size_t>(h) * stride);
+    std::vector<byte> zeroRow(stride);
+    const byte *prev = zeroRow.data();
+    for (std::size_t y = 0; y < h; ++y) {
+        const byte *src = filtered.data() + y * (stride + 1);
+        byte *dst = pixels.data() + y * stride;
+        if (!UnfilterRow(src[0], dst, src + 1, prev, stride, bpp)) {
+            return false;
+        }
+        prev = dst;
+    }
+
+    width = static_cast<int>(w);
+    height = static_cast<int>(h);
+    channels = bpp;
+    return true;
+}
@@ -0,0 +1,16 @@
+#ifndef PNGDECODER_H
+#define PNGDECODER_H
+
+#include "Image.h"
+
+#include <cstddef>
+#include <vector>
+
+// Decoder for the PNGs frame dumps are made of: 8-bit gray, gray+alpha, RGB or RGBA, not interlaced, no palette or
+// tRNS chunk. Inflate is table driven and the row filters are unfiltered with SSE2 where available.
+//
+// Returns false for anything else, including corrupt files, so the caller can fall back to stb_image. Pixels come out
+// exactly as stbi_load(..., 0) would return them.
+bool DecodePng(const byte *file, std::size_t size, std::vector<byte> &pixels, int &width, int &height, int &channels);
+
+#endif
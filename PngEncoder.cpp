@@ -0,0 +1,399 @@
+#include "PngEncoder.h"
+
+#include "ScopeTrace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace {
+// Encoder threads that may still be started; see PngStreamEncoder::SetThreadLimit.
+std::atomic<int> spareThreads{0};
+
+bool TakeThread() {
+    int spare = spareThreads.load();
+    while (spare > 0) {
+        if (spareThreads.compare_exchange_weak(spare, spare - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// stb_image_write's deflate: 16384 hash chains, each trimmed to its newest 8 positions once it reaches 16, matches
+// searched oldest first with ties going to the newest, one step of lazy matching and fixed Huffman codes.
+constexpr int hashSize = 16384;
+constexpr int chainTrim = 8;
+constexpr int chainMax = 2 * chainTrim;
+constexpr int maxMatch = 258;
+constexpr int window = 32768;
+// A position is only compressed once the bytes its match and the lazy match after it can compare are filtered.
+constexpr std::size_t lookahead = maxMatch + 1;
+
+constexpr std::array<int, 30> lengthBase = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23,  27,
+                                            31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259};
+constexpr std::array<int, 29> lengthExtra = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                             2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::array<int, 31> distBase = {1,    2,    3,    4,    5,    7,     9,     13,    17,    25,   33,
+                                          49,   65,   97,   129,  193,  257,   385,   513,   769,   1025, 1537,
+                                          2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 32768};
+constexpr std::array<int, 30> distExtra = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+constexpr uint32_t ReverseBits(uint32_t code, int count) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < count; ++i) {
+        reversed = reversed << 1 | (code >> i & 1);
+    }
+    return reversed;
+}
+
+struct HuffmanCode {
+    uint32_t bits;
+    int count;
+};
+
+// The fixed literal/length codes, bit reversed for writing least significant bit first.
+constexpr std::array<HuffmanCode, 288> fixedCodes = [] {
+    std::array<HuffmanCode, 288> codes{};
+    for (uint32_t n = 0; n < codes.size(); ++n) {
+        if (n <= 143) {
+            codes[n] = {ReverseBits(0x30 + n, 8), 8};
+        } else if (n <= 255) {
+            codes[n] = {ReverseBits(0x190 + n - 144, 9), 9};
+        } else if (n <= 279) {
+            codes[n] = {ReverseBits(n - 256, 7), 7};
+        } else {
+            codes[n] = {ReverseBits(0xc0 + n - 280, 8), 8};
+        }
+    }
+    return codes;
+}();
+
+constexpr std::array<uint32_t, 256> crcTable = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t n = 0; n < table.size(); ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        table[n] = c;
+    }
+    return table;
+}();
+
+uint32_t Crc32(const byte *data, std::size_t size) {
+    uint32_t crc = ~0u;
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t Adler32(const byte *data, std::size_t size) {
+    uint32_t s1 = 1;
+    uint32_t s2 = 0;
+    while (size > 0) {
+        std::size_t block = std::min<std::size_t>(size, 5552);
+        for (std::size_t i = 0; i < block; ++i) {
+            s1 += data[i];
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+        data += block;
+        size -= block;
+    }
+    return s2 << 16 | s1;
+}
+
+uint32_t Hash(const byte *p) {
+    uint32_t hash = p[0] + (p[1] << 8) + (p[2] << 16);
+    hash ^= hash << 3;
+    hash += hash >> 5;
+    hash ^= hash << 4;
+    hash += hash >> 17;
+    hash ^= hash << 25;
+    hash += hash >> 6;
+    return hash & (hashSize - 1);
+}
+
+// Number of leading bytes a and b have in common, up to limit and maxMatch.
+int MatchLength(const byte *a, const byte *b, std::size_t limit) {
+    int end = static_cast<int>(std::min<std::size_t>(limit, maxMatch));
+    int n = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        for (; n + 8 <= end; n += 8) {
+            uint64_t x;
+            uint64_t y;
+            std::memcpy(&x, a + n, sizeof(x));
+            std::memcpy(&y, b + n, sizeof(y));
+            if (x != y) {
+                return n + std::countr_zero(x ^ y) / 8;
+            }
+        }
+    }
+    while (n < end && a[n] == b[n]) {
+        ++n;
+    }
+    return n;
+}
+
+byte Paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return static_cast<byte>(a);
+    }
+    return static_cast<byte>(pb <= pc ? b : c);
+}
+
+void PutBE32(std::vector<byte> &out, uint32_t v) {
+    out.insert(out.end(), {static_cast<byte>(v >> 24), static_cast<byte>(v >> 16), static_cast<byte>(v >> 8),
+                           static_cast<byte>(v)});
+}
+
+void PutChunk(std::vector<byte> &out, const char *tag, const byte *data, std::size_t size) {
+    PutBE32(out, static_cast<uint32_t>(size));
+    std::size_t start = out.size();
+    out.insert(out.end(), tag, tag + 4);
+    out.insert(out.end(), data, data + size);
+    PutBE32(out, Crc32(out.data() + start, size + 4));
+}
+} // namespace
+
+void PngStreamEncoder::SetThreadLimit(int threads) { spareThreads = std::max(threads, 0); }
+
+PngStreamEncoder::PngStreamEncoder(const Image &image)
+    : mImage(image), mRowBytes(static_cast<std::size_t>(image.width()) * image.channels()),
+      mChains(static_cast<std::size_t>(hashSize) * chainMax), mChainLengths(hashSize) {
+    mFiltered.reserve((mRowBytes + 1) * image.height());
+    // zlib header for a 32K window, then a single final block with fixed codes.
+    mZlib = {0x78, 0x5e};
+    PutBits(1, 1);
+    PutBits(1, 2);
+    if (TakeThread()) {
+        mThread = std::thread(&PngStreamEncoder::Run, this);
+    }
+}
+
+PngStreamEncoder::~PngStreamEncoder() {
+    if (mThread.joinable()) {
+        {
+            std::unique_lock lock(mMutex);
+            mStop = true;
+        }
+        mCv.notify_one();
+        mThread.join();
+        ++spareThreads;
+    }
+}
+
+void PngStreamEncoder::RowsDone(int rows) {
+    rows = std::min(rows, mImage.height());
+    if (!mThread.joinable()) {
+        if (rows > mRowsFiltered) {
+            Encode(rows);
+        }
+        return;
+    }
+    {
+        std::unique_lock lock(mMutex);
+        mRowsDone = std::max(mRowsDone, rows);
+    }
+    mCv.notify_one();
+}
+
+bool PngStreamEncoder::Finish(const char *filename) {
+    RowsDone(mImage.height());
+    if (mThread.joinable()) {
+        mThread.join();
+        ++spareThreads;
+    }
+    TRACE_SCOPE("PngStreamEncoder::Finish");
+
+    // stb_image_write's color types by channel count: gray, gray+alpha, RGB and RGBA.
+    constexpr std::array<byte, 5> colorTypes = {0, 0, 4, 2, 6};
+    std::vector<byte> header;
+    PutBE32(header, static_cast<uint32_t>(mImage.width()));
+    PutBE32(header, static_cast<uint32_t>(mImage.height()));
+    header.insert(header.end(), {8, colorTypes[mImage.channels()], 0, 0, 0});
+
+    std::vector<byte> file = {137, 80, 78, 71, 13, 10, 26, 10};
+    file.reserve(file.size() + 3 * 12 + header.size() + mZlib.size());
+    PutChunk(file, "IHDR", header.data(), header.size());
+    PutChunk(file, "IDAT", mZlib.data(), mZlib.size());
+    PutChunk(file, "IEND", nullptr, 0);
+
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(file.data()), static_cast<std::streamsize>(file.size()));
+    return out.good();
+}
+
+void PngStreamEncoder::Run() {
+    TRACE_SCOPE("PngStreamEncoder::Run");
+    while (mRowsFiltered < mImage.height()) {
+        int rows;
+        {
+            std::unique_lock lock(mMutex);
+            mCv.wait(lock, [&] { return mStop || mRowsDone > mRowsFiltered; });
+            if (mStop) {
+                return;
+            }
+            rows = mRowsDone;
+        }
+        Encode(rows);
+    }
+}
+
+void PngStreamEncoder::Encode(int rows) {
+    FilterRows(mRowsFiltered, rows);
+    mRowsFiltered = rows;
+    Deflate(rows == mImage.height());
+    if (rows == mImage.height()) {
+        uint32_t adler = Adler32(mFiltered.data(), mFiltered.size());
+        PutBE32(mZlib, adler);
+    }
+}
+
+void PngStreamEncoder::FilterRows(int y0, int y1) {
+    std::size_t n = static_cast<std::size_t>(mImage.channels());
+    std::array<std::vector<byte>, 5> lines;
+    for (auto &line : lines) {
+        line.resize(mRowBytes);
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        const byte *z = mImage.pixel(0, y);
+        // The first row has no row above; stb_image_write treats it as zeros, filtering up as none, average as half
+        // the left neighbour and Paeth as sub, but still records the filter asked for.
+        const byte *up = y > 0 ? mImage.pixel(0, y - 1) : nullptr;
+        for (std::size_t i = 0; i < mRowBytes; ++i) {
+            int left = i >= n ? z[i - n] : 0;
+            int above = up ? up[i] : 0;
+            int diagonal = up && i >= n ? up[i - n] : 0;
+            lines[0][i] = z[i];
+            lines[1][i] = static_cast<byte>(z[i] - left);
+            lines[2][i] = static_cast<byte>(z[i] - above);
+            lines[3][i] = static_cast<byte>(z[i] - ((left + above) >> 1));
+            lines[4][i] = static_cast<byte>(z[i] - Paeth(left, above, diagonal));
+        }
+
+        // The filter whose bytes, read as signed, sum to the least magnitude; the first of any tie.
+        int best = 0;
+        int bestSum = 0x7fffffff;
+        for (int type = 0; type < 5; ++type) {
+            int sum = 0;
+            for (byte v : lines[type]) {
+                sum += std::abs(static_cast<int>(static_cast<int8_t>(v)));
+            }
+            if (sum < bestSum) {
+                bestSum = sum;
+                best = type;
+            }
+        }
+        mFiltered.push_back(static_cast<byte>(best));
+        mFiltered.insert(mFiltered.end(), lines[best].begin(), lines[best].end());
+    }
+}
+
+void PngStreamEncoder::Deflate(bool final) {
+    const byte *data = mFiltered.data();
+    std::size_t total = (mRowBytes + 1) * mImage.height();
+    std::size_t available = mFiltered.size();
+    std::size_t end = total >= 3 ? total - 3 : 0;
+    if (!final) {
+        end = std::min(end, available >= lookahead ? available - lookahead : 0);
+    }
+
+    while (mPos < end) {
+        std::size_t i = mPos;
+        uint32_t h = Hash(data + i);
+        uint32_t *chain = &mChains[static_cast<std::size_t>(h) * chainMax];
+        int best = 3;
+        std::size_t bestPos = 0;
+        bool found = false;
+        for (int j = 0; j < mChainLengths[h]; ++j) {
+            if (chain[j] + window > i) {
+                int d = MatchLength(data + chain[j], data + i, total - i);
+                if (d >= best) {
+                    best = d;
+                    bestPos = chain[j];
+                    found = true;
+                }
+            }
+        }
+        if (mChainLengths[h] == chainMax) {
+            std::copy(chain + chainTrim, chain + chainMax, chain);
+            mChainLengths[h] = chainTrim;
+        }
+        chain[mChainLengths[h]++] = static_cast<uint32_t>(i);
+
+        if (found) {
+            // Lazy matching: if the next position matches longer, this one goes out as a literal.
+            uint32_t next = Hash(data + i + 1);
+            const uint32_t *nextChain = &mChains[static_cast<std::size_t>(next) * chainMax];
+            for (int j = 0; j < mChainLengths[next]; ++j) {
+                if (nextChain[j] + window - 1 > i &&
+                    MatchLength(data + nextChain[j], data + i + 1, total - i - 1) > best) {
+                    found = false;
+                    break;
+                }
+            }
+        }
+
+        if (found) {
+            int d = static_cast<int>(i - bestPos);
+            int code = 0;
+            while (best > lengthBase[code + 1] - 1) {
+                ++code;
+            }
+            PutBits(fixedCodes[257 + code].bits, fixedCodes[257 + code].count);
+            if (lengthExtra[code]) {
+                PutBits(static_cast<uint32_t>(best - lengthBase[code]), lengthExtra[code]);
+            }
+            code = 0;
+            while (d > distBase[code + 1] - 1) {
+                ++code;
+            }
+            PutBits(ReverseBits(static_cast<uint32_t>(code), 5), 5);
+            if (distExtra[code]) {
+                PutBits(static_cast<uint32_t>(d - distBase[code]), distExtra[code]);
+            }
+            mPos += static_cast<std::size_t>(best);
+        } else {
+            PutBits(fixedCodes[data[i]].bits, fixedCodes[data[i]].count);
+            ++mPos;
+        }
+    }
+
+    if (final) {
+        for (; mPos < total; ++mPos) {
+            PutBits(fixedCodes[data[mPos]].bits, fixedCodes[data[mPos]].count);
+        }
+        PutBits(fixedCodes[256].bits, fixedCodes[256].count);
+        // Pad to a whole byte.
+        PutBits(0, (8 - mBitCount % 8) % 8);
+        while (mBitCount > 0) {
+            mZlib.push_back(static_cast<byte>(mBitBuffer));
+            mBitBuffer >>= 8;
+            mBitCount -= 8;
+        }
+    }
+}
+
+void PngStreamEncoder::PutBits(uint32_t bits, int count) {
+    mBitBuffer |= static_cast<uint64_t>(bits) << mBitCount;
+    mBitCount += count;
+    while (mBitCount >= 8) {
+        mZlib.push_back(static_cast<byte>(mBitBuffer));
+        mBitBuffer >>= 8;
+        mBitCount -= 8;
+    }
+}
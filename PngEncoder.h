@@ -0,0 +1,79 @@
+#ifndef PNGENCODER_H
+#define PNGENCODER_H
+
+#include "Image.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Encodes an image to PNG while it is still being drawn, top down: rows reported finished are filtered and deflated
+// on a thread of the encoder's own while the caller draws the ones below. Files come out byte for byte as
+// Image::save writes them, with the same per-row filter choice and deflate stream; only the work is spread out.
+//
+// The encoder threads are extra threads on top of whatever the callers run on, so their number is capped by
+// SetThreadLimit. An encoder started while all of them are taken encodes on the caller's thread instead, each band
+// as it's reported finished.
+class PngStreamEncoder {
+  public:
+    // How many encoders may run a thread of their own at once; 0, the default, encodes everything on the callers'
+    // threads. Set it before starting any encoder.
+    static void SetThreadLimit(int threads);
+
+    // Starts encoding image, which must stay alive and keep its size until Finish or destruction. No row is read
+    // before it has been reported finished.
+    explicit PngStreamEncoder(const Image &image);
+
+    // Stops encoding without writing anything, unless Finish was called.
+    ~PngStreamEncoder();
+
+    PngStreamEncoder(const PngStreamEncoder &) = delete;
+    PngStreamEncoder &operator=(const PngStreamEncoder &) = delete;
+
+    // Rows [0, rows) won't change anymore. Without a thread of its own, the encoder encodes them before returning.
+    void RowsDone(int rows);
+
+    // Waits for every row to be encoded, all of them being finished now, and writes the file. Returns false if it
+    // can't be written.
+    bool Finish(const char *filename);
+
+  private:
+    void Run();
+
+    // Filters and compresses the rows from mRowsFiltered up to rows, finishing the stream at the last row.
+    void Encode(int rows);
+
+    // Appends the filtered rows [y0, y1) to mFiltered.
+    void FilterRows(int y0, int y1);
+
+    // Compresses mFiltered up to where matches could still reach into rows not filtered yet, or to the end.
+    void Deflate(bool final);
+
+    void PutBits(uint32_t bits, int count);
+
+    const Image &mImage;
+    std::size_t mRowBytes;
+
+    std::mutex mMutex;
+    std::condition_variable mCv;
+    int mRowsDone = 0;
+    bool mStop = false;
+
+    // Owned by the encoder thread, if there is one, until it's joined.
+    int mRowsFiltered = 0;
+    std::vector<byte> mFiltered;
+    // Hash chains of positions in mFiltered, kept and trimmed as stb_image_write keeps them.
+    std::vector<uint32_t> mChains;
+    std::vector<uint8_t> mChainLengths;
+    std::size_t mPos = 0;
+    std::vector<byte> mZlib;
+    uint64_t mBitBuffer = 0;
+    int mBitCount = 0;
+
+    std::thread mThread;
+};
+
+#endif
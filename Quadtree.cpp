@@ -1,8 +1,18 @@
 #include "Quadtree.h"
 
+#include "ScopeTrace.h"
+
 #include <algorithm>
 #include <array>
-#include <mutex>
+#include <chrono>
+#include <numeric>
+#include <set>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUADTREE_SSE2
+#endif
 
 namespace {
 std::vector<Image> BuildLeafCache(const Image &leafImage, Rect bounds, std::size_t maxDepth) {
@@ -15,8 +25,8 @@ std::vector<Image> BuildLeafCache(const Image &leafImage, Rect bounds, std::size
     return ret;
 }
 
-std::tuple<int, bool> GetBestSplitCount(const Image &leafImage, Rect bounds) {
-    double leafAR = static_cast<double>(leafImage.width()) / leafImage.height();
+std::tuple<int, bool> GetBestSplitCount(ImageView leafImage, Rect bounds) {
+    double leafAR = static_cast<double>(leafImage.width) / leafImage.height;
     double w = static_cast<double>(bounds.w);
     double h = bounds.h * leafAR;
     double bestAR = w > h ? w / h : h / w;
@@ -25,27 +35,45 @@ std::tuple<int, bool> GetBestSplitCount(const Image &leafImage, Rect bounds) {
         ++bestCount;
     return {bestCount, w > h};
 }
-} // namespace
 
-Quadtree::Quadtree(Image leafImage, QuadtreeParameters params, SubdivisionChecker::Ptr checker)
-    : mLeafImage(std::move(leafImage)), mParams(std::move(params)), mSubChecker(std::move(checker)) {}
+// Boundary i of parts equal slices of [start, start + size). With an alignment above 1, inner boundaries of slices at
+// least that long move to the nearest multiple of it, measured from the frame's origin. Moving each by at most half the
+// alignment keeps every slice non-empty and in order; the last slice still ends at start + size, so it is cropped
+// where a frame edge isn't aligned.
+int SlicePoint(int start, int size, int i, int parts, int align) {
+    int point = start + size * i / parts;
+    if (align <= 1 || size < align * parts || i == 0 || i == parts) {
+        return point;
+    }
+    return (point + align / 2) / align * align;
+}
 
-Image Quadtree::ProcessFrame(Image frame) {
-    Rect bounds{0, 0, frame.width(), frame.height()};
-    auto [splitCount, horizontal] = GetBestSplitCount(mLeafImage, bounds);
+// Top level strips of roughly the leaf's aspect ratio, with the remainder spread evenly between them, or at aligned
+// boundaries.
+std::vector<Rect> SplitIntoStrips(ImageView leafImage, Rect bounds, int align) {
+    auto [splitCount, horizontal] = GetBestSplitCount(leafImage, bounds);
     int &size = horizontal ? bounds.w : bounds.h;
     int &pos = horizontal ? bounds.x : bounds.y;
+    if (align > 1) {
+        int start = pos;
+        int total = size;
+        std::vector<Rect> strips;
+        for (int i = 0; i < splitCount; ++i) {
+            pos = SlicePoint(start, total, i, splitCount, align);
+            size = SlicePoint(start, total, i + 1, splitCount, align) - pos;
+            strips.push_back(bounds);
+        }
+        return strips;
+    }
+
     int step = size / splitCount;
     int errStep = size - step * splitCount;
     int err = errStep;
     size = step;
 
+    std::vector<Rect> strips;
     for (int i = 0; i < splitCount; ++i) {
-        auto result = ProcessFrame(frame, bounds);
-
-        if (result) {
-            RenderLeaf(frame, *result);
-        }
+        strips.push_back(bounds);
 
         pos += size;
         err += errStep;
@@ -56,7 +84,253 @@ Image Quadtree::ProcessFrame(Image frame) {
             size = step;
         }
     }
-    return frame;
+    return strips;
+}
+
+std::array<Rect, 4> SplitQuad(Rect bounds, int align) {
+    int ulX = bounds.x;
+    int ulY = bounds.y;
+    int mmX = SlicePoint(bounds.x, bounds.w, 1, 2, align);
+    int mmY = SlicePoint(bounds.y, bounds.h, 1, 2, align);
+    int brX = bounds.x + bounds.w;
+    int brY = bounds.y + bounds.h;
+
+    return {Rect{ulX, ulY, mmX - ulX, mmY - ulY}, Rect{mmX, ulY, brX - mmX, mmY - ulY},
+            Rect{ulX, mmY, mmX - ulX, brY - mmY}, Rect{mmX, mmY, brX - mmX, brY - mmY}};
+}
+
+// Calls f with each cell of a cols by rows grid over bounds, in row major order, sized like SplitQuad's.
+template <class F> void ForEachCell(Rect bounds, int cols, int rows, int align, F &&f) {
+    for (int j = 0; j < rows; ++j) {
+        int y0 = SlicePoint(bounds.y, bounds.h, j, rows, align);
+        int y1 = SlicePoint(bounds.y, bounds.h, j + 1, rows, align);
+        for (int i = 0; i < cols; ++i) {
+            int x0 = SlicePoint(bounds.x, bounds.w, i, cols, align);
+            int x1 = SlicePoint(bounds.x, bounds.w, i + 1, cols, align);
+            f(Rect{x0, y0, x1 - x0, y1 - y0});
+        }
+    }
+}
+
+uint64_t RectKey(Rect r) {
+    uint64_t key = 0;
+    for (int v : {r.x, r.y, r.w, r.h}) {
+        key = key << 16 | static_cast<uint16_t>(v);
+    }
+    return key;
+}
+
+byte Lerp(byte a, byte b, float t) { return static_cast<byte>(std::lround(a + (b - a) * t)); }
+
+// Deterministic per-leaf phase offset, stable for as long as the leaf keeps its bounds.
+int GetLeafPhase(Rect bounds, int frameCount) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int v : {bounds.x, bounds.y, bounds.w, bounds.h}) {
+        h = (h ^ static_cast<uint32_t>(v)) * 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return static_cast<int>(h % static_cast<uint64_t>(frameCount));
+}
+} // namespace
+
+Quadtree::Quadtree(SpriteStore::Ptr store, QuadtreeParameters params, SubdivisionChecker::Ptr checker,
+                   SpriteMatcher::Ptr matcher)
+    : mStore(std::move(store)), mParams(std::move(params)), mSubChecker(std::move(checker)),
+      mMatcher(std::move(matcher)) {}
+
+Image Quadtree::ProcessFrame(const Image &frame, int phase) {
+    Image rendered(frame.width(), frame.height(), frame.channels());
+    Render(Analyze(frame), rendered, phase);
+    return rendered;
+}
+
+FrameStats::FrameStats(const Image &frame, bool withLuma, int denoiseRadius)
+    : frame(frame), sums(frame), denoiseRadius(std::clamp(denoiseRadius, 0, std::max(frame.width(), frame.height()))) {
+    if (withLuma) {
+        luma.emplace(frame.lumaNew());
+    }
+    if (this->denoiseRadius > 0) {
+        denoised.emplace(sums.BoxFilter(this->denoiseRadius));
+    }
+}
+
+void FrameStats::CompareWith(const Image &previous) {
+    TRACE_SCOPE("FrameStats::CompareWith");
+    changes = std::nullopt;
+    if (previous.width() != frame.width() || previous.height() != frame.height() ||
+        previous.channels() != frame.channels()) {
+        return;
+    }
+
+    int channels = frame.channels();
+    auto rowBytes = static_cast<std::size_t>(frame.width()) * channels;
+    Image changed(frame.width(), frame.height(), 1);
+    for (int y = 0; y < frame.height(); ++y) {
+        const byte *a = frame.pixel(0, y);
+        const byte *b = previous.pixel(0, y);
+        byte *dst = changed.pixel(0, y);
+        // Still areas are what there is to reuse, so rows often match as a whole.
+        if (std::equal(a, a + rowBytes, b)) {
+            std::fill(dst, dst + frame.width(), 0);
+            continue;
+        }
+        for (int x = 0; x < frame.width(); ++x) {
+            dst[x] = !std::equal(a + x * channels, a + (x + 1) * channels, b + x * channels);
+        }
+    }
+    changes.emplace(changed);
+}
+
+Quadtree::LeafList Quadtree::Analyze(const Image &frame) const { return Analyze(FrameStats(frame, NeedsLuma())); }
+
+Quadtree::LeafList Quadtree::Analyze(const FrameStats &stats) const {
+    TRACE_SCOPE("Quadtree::Analyze");
+    LeafList leaves;
+    const Image &frame = stats.frame;
+    FrameContext ctx{stats, leaves, GetMinSize(frame.height()), nullptr, {}};
+    for (const auto &cell : GetRootCells(frame.width(), frame.height())) {
+        if (auto result = Subdivide(ctx, cell, 0)) {
+            AddLeaf(ctx, *result);
+        }
+    }
+    return leaves;
+}
+
+Quadtree::LeafList Quadtree::Analyze(const FrameStats &stats, const LeafList &previous) const {
+    if (!stats.changes) {
+        return Analyze(stats);
+    }
+
+    TRACE_SCOPE("Quadtree::Analyze");
+    LeafList leaves;
+    const Image &frame = stats.frame;
+    FrameContext ctx{stats, leaves, GetMinSize(frame.height()), &previous, {}};
+    for (std::size_t i = 0; i < previous.size(); ++i) {
+        ctx.previousAt.emplace(RectKey(Rect{previous[i].bounds.x, previous[i].bounds.y, 0, 0}), i);
+    }
+    for (const auto &cell : GetRootCells(frame.width(), frame.height())) {
+        if (auto result = Subdivide(ctx, cell, 0)) {
+            AddLeaf(ctx, *result);
+        }
+    }
+    return leaves;
+}
+
+Quadtree::LeafList Quadtree::Interpolate(const LeafList &from, const LeafList &to, int width, int height,
+                                         float t) const {
+    TRACE_SCOPE("Quadtree::Interpolate");
+    std::unordered_map<uint64_t, const LeafData *> fromLeaves;
+    std::unordered_map<uint64_t, const LeafData *> toLeaves;
+    for (const auto &leaf : from) {
+        fromLeaves.emplace(RectKey(leaf.bounds), &leaf);
+    }
+    for (const auto &leaf : to) {
+        toLeaves.emplace(RectKey(leaf.bounds), &leaf);
+    }
+
+    // Both lists come from the same top level cells and splits, so any two leaves are either disjoint or nested.
+    // Walking the tree down until both sides have a leaf at or above the node yields the finer of the two
+    // subdivisions.
+    LeafList leaves;
+    int minSize = GetMinSize(height);
+    auto blend = [&](auto &self, Rect bounds, int depth, const LeafData *a, const LeafData *b) -> void {
+        auto key = RectKey(bounds);
+        if (auto it = fromLeaves.find(key); !a && it != fromLeaves.end()) {
+            a = it->second;
+        }
+        if (auto it = toLeaves.find(key); !b && it != toLeaves.end()) {
+            b = it->second;
+        }
+
+        if (!(a && b) && bounds.w > minSize && bounds.h > minSize) {
+            int split = GetSplit(bounds, depth, minSize);
+            ForEachCell(bounds, split, split, mParams.blockAlign,
+                        [&](Rect child) { self(self, child, depth + 1, a, b); });
+            return;
+        }
+
+        // Both sides should cover every leaf sized node; if the lists were analyzed with different settings and one
+        // doesn't, hold the other.
+        if (!a && !b) {
+            return;
+        }
+        a = a ? a : b;
+        b = b ? b : a;
+
+        LeafData leaf{RgbColor{Lerp(a->color.r, b->color.r, t), Lerp(a->color.g, b->color.g, t),
+                               Lerp(a->color.b, b->color.b, t)},
+                      bounds};
+        leaf.depth = depth;
+        // The matched sprite follows whichever side has this exact leaf, i.e. the finer one.
+        bool aExact = RectKey(a->bounds) == key;
+        bool bExact = RectKey(b->bounds) == key;
+        if (aExact && bExact) {
+            leaf.sprite = (t < 0.5f ? a : b)->sprite;
+        } else if (aExact || bExact) {
+            leaf.sprite = (aExact ? a : b)->sprite;
+        }
+        leaves.push_back(leaf);
+    };
+
+    for (const auto &cell : GetRootCells(width, height)) {
+        blend(blend, cell, 0, nullptr, nullptr);
+    }
+    return leaves;
+}
+
+void Quadtree::Render(const LeafList &leaves, Image &dst, int phase) {
+    TRACE_SCOPE("Quadtree::Render");
+    // Leaves normally cover the whole frame; clearing first covers any they don't, so nothing is ever read back.
+    dst.fill(mParams.background);
+    for (const auto &leaf : leaves) {
+        RenderLeaf(dst, leaf, phase);
+    }
+}
+
+void Quadtree::Render(const LeafList &leaves, Image &dst, int phase, std::vector<float> &leafNs) {
+    TRACE_SCOPE("Quadtree::Render");
+    using Clock = std::chrono::steady_clock;
+    dst.fill(mParams.background);
+    leafNs.clear();
+    leafNs.reserve(leaves.size());
+    auto start = Clock::now();
+    for (const auto &leaf : leaves) {
+        RenderLeaf(dst, leaf, phase);
+        auto end = Clock::now();
+        leafNs.push_back(std::chrono::duration<float, std::nano>(end - start).count());
+        start = end;
+    }
+}
+
+void Quadtree::Render(const LeafList &leaves, Image &dst, int phase, int bandRows,
+                      const std::function<void(int)> &rowsDone) {
+    TRACE_SCOPE("Quadtree::Render");
+    dst.fill(mParams.background);
+    bandRows = std::max(bandRows, 1);
+    int bands = std::max((dst.height() + bandRows - 1) / bandRows, 1);
+
+    // Leaves don't overlap, so they can go in any order: bucketed by the band their top edge is in, a band's rows
+    // are final once its leaves and those of the bands above are drawn.
+    auto bandOf = [&](const LeafData &leaf) { return std::clamp(leaf.bounds.y / bandRows, 0, bands - 1); };
+    std::vector<int> starts(bands + 1);
+    for (const auto &leaf : leaves) {
+        ++starts[bandOf(leaf) + 1];
+    }
+    std::partial_sum(starts.begin(), starts.end(), starts.begin());
+    std::vector<const LeafData *> order(leaves.size());
+    auto next = starts;
+    for (const auto &leaf : leaves) {
+        order[next[bandOf(leaf)]++] = &leaf;
+    }
+
+    for (int band = 0; band < bands; ++band) {
+        for (int i = starts[band]; i < starts[band + 1]; ++i) {
+            RenderLeaf(dst, *order[i], phase);
+        }
+        rowsDone(std::min((band + 1) * bandRows, dst.height()));
+    }
 }
 
 struct ColorVisitor {
@@ -64,65 +338,224 @@ struct ColorVisitor {
     RgbColor operator()(RgbColor color) { return color; }
 };
 
-void Quadtree::RenderLeaf(Image &dst, const LeafData &data) {
-    dst.rect(data.bounds, mParams.background)
-        .overlay(GetLeaf(data.bounds).colorMaskNew(data.color), data.bounds.x, data.bounds.y);
+void Quadtree::AddLeaf(FrameContext &ctx, LeafData data) const {
+    if (ctx.stats.denoised) {
+        data.color = mSubChecker->GetColor(ctx.stats.sums, data.bounds);
+    }
+    if (mMatcher) {
+        data.sprite = mMatcher->Match(*ctx.stats.luma, data.bounds).value_or(-1);
+    }
+    ctx.leaves.push_back(data);
 }
 
-Quadtree::ProcResult Quadtree::ProcessFrame(Image &frame, Rect bounds) {
-    if (bounds.w <= mParams.minSize || bounds.h <= mParams.minSize) {
-        return LeafData{mSubChecker->GetColor(frame, bounds), bounds};
+void Quadtree::RenderLeaf(Image &dst, const LeafData &data, int phase) {
+    if (mParams.fieldSprites) {
+        dst.blitTintedField(GetLeaf(data, phase), data.bounds.w, data.bounds.h, data.color, mParams.background,
+                            data.bounds.x, data.bounds.y);
+        return;
     }
+    dst.blitTintedScaled(GetLeaf(data, phase), data.bounds.w, data.bounds.h, data.color, mParams.background,
+                         data.bounds.x, data.bounds.y);
+}
 
-    int ulX = bounds.x;
-    int ulY = bounds.y;
-    int mmX = bounds.x + bounds.w / 2;
-    int mmY = bounds.y + bounds.h / 2;
-    int brX = bounds.x + bounds.w;
-    int brY = bounds.y + bounds.h;
+Quadtree::ProcResult Quadtree::Subdivide(FrameContext &ctx, Rect bounds, int depth) const {
+    if (bounds.w <= ctx.minSize || bounds.h <= ctx.minSize) {
+        return LeafData{mSubChecker->GetColor(ctx.stats.AnalysisSums(), bounds), bounds, -1, depth};
+    }
+
+    if (ctx.previous) {
+        if (auto reused = ReusePrevious(ctx, bounds)) {
+            return *reused;
+        }
+    }
+
+    int split = GetSplit(bounds, depth, ctx.minSize);
+    if (split == 2) {
+        auto children = SplitQuad(bounds, mParams.blockAlign);
+        std::array<ProcResult, 4> results = {
+            Subdivide(ctx, children[0], depth + 1), Subdivide(ctx, children[1], depth + 1),
+            Subdivide(ctx, children[2], depth + 1), Subdivide(ctx, children[3], depth + 1)};
+
+        if (std::all_of(results.begin(), results.end(),
+                        [](const ProcResult &result) { return result.has_value(); })) {
+            auto [doMerge, color] =
+                std::apply([&](const auto &...args) { return mSubChecker->Merge((args->color)...); }, results);
+            if (doMerge) {
+                return LeafData{color, bounds, -1, depth};
+            }
+        }
+
+        for (const auto &result : results) {
+            if (result) {
+                AddLeaf(ctx, *result);
+            }
+        }
+        return std::nullopt;
+    }
 
-    std::array<ProcResult, 4> results = {ProcessFrame(frame, Rect{ulX, ulY, mmX - ulX, mmY - ulY}),
-                                         ProcessFrame(frame, Rect{mmX, ulY, brX - mmX, mmY - ulY}),
-                                         ProcessFrame(frame, Rect{ulX, mmY, mmX - ulX, brY - mmY}),
-                                         ProcessFrame(frame, Rect{mmX, mmY, brX - mmX, brY - mmY})};
+    // The same for a larger grid: the node is a leaf only if every cell is and all of them merge at once.
+    std::array<ProcResult, maxSplit * maxSplit> results;
+    std::array<RgbColor, maxSplit * maxSplit> colors;
+    int count = 0;
+    bool allLeaves = true;
+    ForEachCell(bounds, split, split, mParams.blockAlign, [&](Rect child) {
+        results[count] = Subdivide(ctx, child, depth + 1);
+        if (results[count]) {
+            colors[count] = results[count]->color;
+        } else {
+            allLeaves = false;
+        }
+        ++count;
+    });
 
-    if (std::all_of(results.begin(), results.end(), [](const ProcResult &result) { return result.has_value(); })) {
-        auto [doMerge, color] =
-            std::apply([&](const auto &...args) { return mSubChecker->Merge((args->color)...); }, results);
+    if (allLeaves) {
+        auto [doMerge, color] = mSubChecker->MergeAll(std::span(colors.data(), count));
         if (doMerge) {
-            return LeafData{color, bounds};
+            return LeafData{color, bounds, -1, depth};
         }
     }
 
-    for (const auto &result : results) {
-        if (result) {
-            RenderLeaf(frame, *result);
+    for (int i = 0; i < count; ++i) {
+        if (results[i]) {
+            AddLeaf(ctx, *results[i]);
         }
     }
     return std::nullopt;
 }
 
-const Image &Quadtree::GetLeaf(Rect bounds) {
-    auto size = std::make_pair(bounds.w, bounds.h);
+std::optional<Quadtree::ProcResult> Quadtree::ReusePrevious(FrameContext &ctx, Rect bounds) const {
+    // A node's subdivision only depends on the pixels it covers and, when denoising, those within the radius.
+    const auto &stats = ctx.stats;
+    int r = stats.denoiseRadius;
+    int x0 = std::max(bounds.x - r, 0);
+    int y0 = std::max(bounds.y - r, 0);
+    int x1 = std::min(bounds.x + bounds.w + r, stats.frame.width());
+    int y1 = std::min(bounds.y + bounds.h + r, stats.frame.height());
+    if (stats.changes->Sum(Rect{x0, y0, x1 - x0, y1 - y0}, 0) != 0) {
+        return std::nullopt;
+    }
 
-    {
-        std::shared_lock lock(*mCacheMutex);
-        auto it = mLeafCache.find(size);
-        if (it != mLeafCache.end())
-            return it->second;
+    // Nodes split the same way in every frame, so a leaf at the node's corner is either the node itself, one of its
+    // descendants, or an ancestor it was merged into.
+    auto it = ctx.previousAt.find(RectKey(Rect{bounds.x, bounds.y, 0, 0}));
+    if (it == ctx.previousAt.end()) {
+        return std::nullopt;
+    }
+    const auto &previous = *ctx.previous;
+    const auto &corner = previous[it->second];
+    if (RectKey(corner.bounds) == RectKey(bounds)) {
+        // Handed to the parent to merge, which needs the color subdivision saw rather than the denoised frame's.
+        if (stats.denoised) {
+            return std::nullopt;
+        }
+        return ProcResult{corner};
     }
+    auto within = [&](std::size_t i) {
+        const Rect &b = previous[i].bounds;
+        return b.x >= bounds.x && b.y >= bounds.y && b.x + b.w <= bounds.x + bounds.w &&
+               b.y + b.h <= bounds.y + bounds.h;
+    };
+    if (!within(it->second)) {
+        return std::nullopt;
+    }
+
+    // A node that isn't a leaf adds all of its descendants' leaves itself, one after another.
+    std::size_t first = it->second;
+    std::size_t last = first + 1;
+    while (first > 0 && within(first - 1)) {
+        --first;
+    }
+    while (last < previous.size() && within(last)) {
+        ++last;
+    }
+    ctx.leaves.insert(ctx.leaves.end(), previous.begin() + first, previous.begin() + last);
+    return ProcResult{};
+}
 
-    {
-        // Possible for multiple threads to get here just not simultaneously; ultimately this would be fine but would do
-        // extra work by doing redundant resizing which gets discarded, so we're going to do a find again.
-        // An alternative is to use call_once, but that would require an extra map of once_flag.
-        std::unique_lock lock(*mCacheMutex);
-        auto it = mLeafCache.find(size);
-        if (it == mLeafCache.end()) {
-            it = mLeafCache.emplace(size, mLeafImage.resizeFastNew(size.first, size.second)).first;
+std::vector<Rect> Quadtree::GetRootCells(int width, int height) const {
+    auto strips = SplitIntoStrips(mStore->GetImage(0), Rect{0, 0, width, height}, mParams.blockAlign);
+    if (mParams.rootCell <= 0) {
+        return strips;
+    }
+
+    std::vector<Rect> cells;
+    for (const auto &strip : strips) {
+        int cols = (strip.w + mParams.rootCell - 1) / mParams.rootCell;
+        int rows = (strip.h + mParams.rootCell - 1) / mParams.rootCell;
+        ForEachCell(strip, cols, rows, mParams.blockAlign, [&](Rect cell) { cells.push_back(cell); });
+    }
+    return cells;
+}
+
+int Quadtree::GetMinSize(int height) const {
+    int source = std::max(mParams.sourceHeight, height);
+    int minSize = mParams.minSize;
+    if (mParams.outputHeight > 0 && source > mParams.outputHeight) {
+        int scaled = (mParams.minOutputSize * source + mParams.outputHeight - 1) / mParams.outputHeight;
+        minSize = std::max(minSize, scaled);
+    }
+    // A frame decoded at a fraction of the source height gets leaves of the same fraction.
+    return std::max((minSize * height + source - 1) / source, 1);
+}
+
+int Quadtree::GetSplit(Rect bounds, int depth, int minSize) const {
+    if (depth >= static_cast<int>(mParams.splits.size())) {
+        return 2;
+    }
+    int split = std::clamp(mParams.splits[depth], 2, maxSplit);
+    return std::min(bounds.w, bounds.h) >= split * minSize ? split : 2;
+}
+
+std::vector<std::pair<int, int>> Quadtree::GetLeafSizes(int width, int height) const {
+    TRACE_SCOPE("Quadtree::GetLeafSizes");
+    // Same top level cells and splits as Analyze, on sizes alone; every node reached can end up as a leaf once
+    // merged. Past the configured splits the depth no longer matters, and aligned splits only depend on where a node
+    // sits within a block, so nodes there are only told apart by size and that offset.
+    int lastSplitDepth = static_cast<int>(mParams.splits.size());
+    int minSize = GetMinSize(height);
+    int align = std::max(mParams.blockAlign, 1);
+    auto offset = [align](Rect r) { return Rect{r.x % align, r.y % align, r.w, r.h}; };
+    std::set<std::pair<int, int>> sizes;
+    std::set<std::tuple<int, int, int, int, int>> visited;
+    std::vector<std::pair<Rect, int>> pending;
+    for (const auto &cell : GetRootCells(width, height)) {
+        pending.emplace_back(offset(cell), 0);
+    }
+    while (!pending.empty()) {
+        auto [bounds, depth] = pending.back();
+        pending.pop_back();
+        if (!visited.emplace(bounds.x, bounds.y, bounds.w, bounds.h, std::min(depth, lastSplitDepth)).second) {
+            continue;
         }
-        return it->second;
+        sizes.emplace(bounds.w, bounds.h);
+        if (bounds.w <= minSize || bounds.h <= minSize) {
+            continue;
+        }
+        int split = GetSplit(bounds, depth, minSize);
+        ForEachCell(bounds, split, split, mParams.blockAlign,
+                    [&](Rect child) { pending.emplace_back(offset(child), depth + 1); });
     }
+    return {sizes.begin(), sizes.end()};
+}
+
+ImageView Quadtree::GetLeaf(const LeafData &data, int phase) {
+    TRACE_SCOPE("Quadtree::GetLeaf");
+    SpriteStore *store = mStore.get();
+    int frame = phase;
+    if (data.sprite >= 0) {
+        store = &mMatcher->GetSprites();
+        frame = data.sprite;
+    } else if (mParams.phaseOffsets) {
+        frame = (frame + GetLeafPhase(data.bounds, mStore->FrameCount())) % mStore->FrameCount();
+    }
+
+    if (mParams.fieldSprites) {
+        return store->GetField(frame);
+    }
+    if (mParams.mipSprites) {
+        return store->GetMip(frame, data.bounds.w, data.bounds.h);
+    }
+    return store->GetLeaf(frame, data.bounds.w, data.bounds.h);
 }
 
 namespace {
@@ -134,19 +567,27 @@ template <class T> T bound(double x) {
     return static_cast<T>(std::round(x));
 }
 
+RgbColor Average(std::span<const RgbColor> colors) {
+    int r = 0;
+    int g = 0;
+    int b = 0;
+    for (const auto &c : colors) {
+        r += c.r;
+        g += c.g;
+        b += c.b;
+    }
+    int n = static_cast<int>(colors.size());
+    return {static_cast<byte>(r / n), static_cast<byte>(g / n), static_cast<byte>(b / n)};
+}
+
 class SubdivisionBW : public SubdivisionChecker {
   public:
     SubdivisionBW(const BWParameters &params) : mParams(params) {}
 
     ~SubdivisionBW() override = default;
 
-    RgbColor GetColor(const Image &frame, Rect r) const override {
-        double sum = 0;
-        for (int y = r.y; y < r.h + r.y; ++y) {
-            for (int x = r.x; x < r.w + r.x; ++x) {
-                sum += frame.pixel(x, y)[0];
-            }
-        }
+    RgbColor GetColor(const IntegralImage &sums, Rect r) const override {
+        double sum = sums.Sum(r, 0);
 
         byte val = bound<byte>(sum / (r.h * r.w));
 
@@ -164,6 +605,14 @@ class SubdivisionBW : public SubdivisionChecker {
         return std::make_pair(n - m < mParams.similarityThreshold, RgbColor{r, g, b});
     }
 
+    std::tuple<bool, RgbColor> MergeAll(std::span<const RgbColor> children) const override {
+        auto [m, n] = std::minmax_element(children.begin(), children.end(),
+                                          [](const RgbColor &x, const RgbColor &y) { return x.r < y.r; });
+        return std::make_pair(n->r - m->r < mParams.similarityThreshold, Average(children));
+    }
+
+    bool UsesColor() const override { return false; }
+
   private:
     BWParameters mParams;
 };
@@ -174,18 +623,10 @@ class SubdivisionColor : public SubdivisionChecker {
 
     ~SubdivisionColor() override = default;
 
-    RgbColor GetColor(const Image &frame, Rect r) const override {
-        double sumR = 0;
-        double sumG = 0;
-        double sumB = 0;
-        for (int y = r.y; y < r.h + r.y; ++y) {
-            for (int x = r.x; x < r.w + r.x; ++x) {
-                auto pix = frame.pixel(x, y);
-                sumR += pix[0];
-                sumG += pix[1];
-                sumB += pix[2];
-            }
-        }
+    RgbColor GetColor(const IntegralImage &sums, Rect r) const override {
+        double sumR = sums.Sum(r, 0);
+        double sumG = sums.Sum(r, 1);
+        double sumB = sums.Sum(r, 2);
 
         sumR /= r.w * r.h;
         sumG /= r.w * r.h;
@@ -199,23 +640,70 @@ class SubdivisionColor : public SubdivisionChecker {
         auto sqr = [](auto x) { return x * x; };
         auto thresh2 = 3 * sqr(mParams.similarityThreshold);
 
+#ifdef QUADTREE_SSE2
+        // Each child as four 16-bit lanes (r, g, b, 0), two children to a register: lo = tl | tr, hi = bl | br.
+        auto pack = [](const RgbColor &c) { return static_cast<int>(c.r | c.g << 8 | c.b << 16); };
+        __m128i zero = _mm_setzero_si128();
+        __m128i children = _mm_set_epi32(pack(br), pack(bl), pack(tr), pack(tl));
+        __m128i lo = _mm_unpacklo_epi8(children, zero);
+        __m128i hi = _mm_unpackhi_epi8(children, zero);
+
+        // The six pairs, two to a register: tl-bl | tr-br, tl-br | tr-bl and tl-tr | bl-br.
+        __m128i d0 = _mm_sub_epi16(lo, hi);
+        __m128i d1 = _mm_sub_epi16(lo, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m128i d2 = _mm_sub_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+
+        // pmaddwd squares and sums r, g and b, 0 into two 32-bit lanes per pair; adding the swapped neighbour leaves
+        // each pair's distance in both of its lanes.
+        auto dist2 = [](__m128i d) {
+            __m128i sq = _mm_madd_epi16(d, d);
+            return _mm_add_epi32(sq, _mm_shuffle_epi32(sq, _MM_SHUFFLE(2, 3, 0, 1)));
+        };
+        // SSE2 has no 32-bit max; distances are small enough for the signed compare.
+        auto max32 = [](__m128i a, __m128i b) {
+            __m128i greater = _mm_cmpgt_epi32(a, b);
+            return _mm_or_si128(_mm_and_si128(greater, a), _mm_andnot_si128(greater, b));
+        };
+        __m128i m = max32(max32(dist2(d0), dist2(d1)), dist2(d2));
+        m = max32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+        int maxDiff = _mm_cvtsi128_si32(m);
+
+        __m128i sum = _mm_add_epi16(lo, hi);
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_unpackhi_epi64(sum, sum)), 2);
+        byte r = static_cast<byte>(_mm_extract_epi16(sum, 0));
+        byte g = static_cast<byte>(_mm_extract_epi16(sum, 1));
+        byte b = static_cast<byte>(_mm_extract_epi16(sum, 2));
+#else
         auto diff2 = [&](const RgbColor &x, const RgbColor &y) {
             return sqr(x.r - y.r) + sqr(x.g - y.g) + sqr(x.b - y.b);
         };
 
-        int maxDiff = 0;
-        for (const auto &d :
-             {diff2(tl, tr), diff2(tl, bl), diff2(tl, br), diff2(tr, bl), diff2(tr, br), diff2(bl, br)}) {
-            maxDiff = std::max(d, maxDiff);
-        }
+        int maxDiff = std::max({diff2(tl, tr), diff2(tl, bl), diff2(tl, br), diff2(tr, bl), diff2(tr, br),
+                                diff2(bl, br)});
 
         byte r = static_cast<byte>((tl.r + tr.r + bl.r + br.r) / 4);
         byte g = static_cast<byte>((tl.g + tr.g + bl.g + br.g) / 4);
         byte b = static_cast<byte>((tl.b + tr.b + bl.b + br.b) / 4);
+#endif
 
         return std::make_pair(maxDiff < thresh2, RgbColor{r, g, b});
     }
 
+    std::tuple<bool, RgbColor> MergeAll(std::span<const RgbColor> children) const override {
+        auto sqr = [](auto x) { return x * x; };
+        auto thresh2 = 3 * sqr(mParams.similarityThreshold);
+
+        int maxDiff = 0;
+        for (std::size_t i = 0; i < children.size(); ++i) {
+            for (std::size_t j = i + 1; j < children.size(); ++j) {
+                const auto &x = children[i];
+                const auto &y = children[j];
+                maxDiff = std::max(maxDiff, sqr(x.r - y.r) + sqr(x.g - y.g) + sqr(x.b - y.b));
+            }
+        }
+        return std::make_pair(maxDiff < thresh2, Average(children));
+    }
+
   private:
     ColorParameters mParams;
 };
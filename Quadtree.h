@@ -2,14 +2,20 @@
 #define QUADTREE_H
 
 #include "Image.h"
+#include "IntegralImage.h"
+#include "SpriteMatcher.h"
+#include "SpriteStore.h"
 
 #include <cstdint>
-#include <map>
+#include <functional>
 #include <memory>
 #include <optional>
-#include <shared_mutex>
+#include <span>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <variant>
+#include <vector>
 
 struct BWParameters {
     int similarityThreshold;
@@ -22,44 +28,162 @@ struct ColorParameters {
 struct QuadtreeParameters {
     int minSize;
     RgbColor background;
+    // Offsets every leaf's animation phase by a hash of its bounds so leaves animate independently.
+    bool phaseOffsets = false;
+    // Scales leaves on the fly from each sprite's mip chain instead of keeping a resized copy for every leaf size.
+    bool mipSprites = false;
+    // Renders leaves from a small distance field of each sprite, antialiased at any size and never resized.
+    bool fieldSprites = false;
+    // Cells per side each node splits into, by depth below the top level cells: {4, 2} splits those 4x4 and their
+    // children 2x2. Deeper levels split 2x2. Splits of 3 or more fall back to 2x2 where cells would end up smaller
+    // than minSize.
+    std::vector<int> splits;
+    // Longest side of a top level cell. The sprite shaped strips are cut into a grid of cells no larger, so large
+    // frames start subdividing this far down; 0 keeps whole strips.
+    int rootCell = 0;
+    // Height rendered frames are scaled to, or 0 if they're saved as analyzed. Frames taller than that are not
+    // subdivided below minOutputSize output pixels either, as finer leaves would be scaled away.
+    int outputHeight = 0;
+    int minOutputSize = 4;
+    // Height of the input frames as stored, or 0 if they're analyzed at that size. minSize and minOutputSize are
+    // measured in source pixels, so frames decoded at a fraction of this height get proportionally smaller leaves
+    // and the same geometry as a full size decode.
+    int sourceHeight = 0;
+    // Snaps strip, cell and split boundaries of nodes at least this large to multiples of it, so leaf edges follow
+    // a video encoder's block grid instead of cutting through blocks; 0 or 1 leaves them where they fall.
+    int blockAlign = 0;
 };
 
+// Largest number of cells per side a node can split into.
+constexpr int maxSplit = 8;
+
 class SubdivisionChecker {
   public:
     using Ptr = std::shared_ptr<SubdivisionChecker>;
 
     virtual ~SubdivisionChecker() = default;
-    virtual RgbColor GetColor(const Image &frame, Rect r) const = 0;
+    virtual RgbColor GetColor(const IntegralImage &sums, Rect r) const = 0;
     virtual std::tuple<bool, RgbColor> Merge(const RgbColor &tl, const RgbColor &tr, const RgbColor &bl,
                                              const RgbColor &br) const = 0;
+    // The same test for any number of children, for splits other than 2x2.
+    virtual std::tuple<bool, RgbColor> MergeAll(std::span<const RgbColor> children) const = 0;
+    // Whether GetColor reads more than the first channel.
+    virtual bool UsesColor() const { return true; }
+};
+
+// Statistics of one decoded frame, built once and shared by every Quadtree analyzing it.
+struct FrameStats {
+    // A denoise radius above 0 makes subdivision decide on the frame box filtered with that radius, so grain and
+    // compression noise don't split leaves down to the minimum size. Leaf colors still come from the frame itself.
+    FrameStats(const Image &frame, bool withLuma, int denoiseRadius = 0);
+
+    // Marks the pixels that differ from previous, the frame before this one in a sequence, so Analyze can take over
+    // that frame's leaves wherever nothing changed. A frame of another size leaves nothing marked.
+    void CompareWith(const Image &previous);
+
+    // Sums subdivision decides on.
+    const IntegralImage &AnalysisSums() const { return denoised ? *denoised : sums; }
+
+    const Image &frame;
+    IntegralImage sums;
+    // Only sprite matching needs luminance.
+    std::optional<IntegralImage> luma;
+    // Sums of the box filtered frame, with a denoise radius.
+    std::optional<IntegralImage> denoised;
+    int denoiseRadius;
+    // Sums of a mask of the pixels that differ from the previous frame, once compared with one of the same size.
+    std::optional<IntegralImage> changes;
 };
 
 class Quadtree {
   public:
-    Quadtree(Image leafImage, QuadtreeParameters params, SubdivisionChecker::Ptr checker);
+    Quadtree(SpriteStore::Ptr store, QuadtreeParameters params, SubdivisionChecker::Ptr checker,
+             SpriteMatcher::Ptr matcher = nullptr);
 
-    Image ProcessFrame(Image frame);
-
-  private:
     struct LeafData {
         RgbColor color;
         Rect bounds;
+        // Sprite picked by the matcher, or -1 to follow the animation phase.
+        int sprite = -1;
+        // Number of splits from the top level cell.
+        int depth = 0;
     };
 
+    using LeafList = std::vector<LeafData>;
+
+    // All of these are safe to call from several threads at once; phase is the animation frame used for the leaves.
+    // Rendering only ever writes to its destination, which is separate from the analyzed frame.
+    Image ProcessFrame(const Image &frame, int phase);
+
+    LeafList Analyze(const Image &frame) const;
+
+    LeafList Analyze(const FrameStats &stats) const;
+
+    // Same, for the frame after the one previous was analyzed from by this tree. Nodes whose subdivision depends on no
+    // pixel in stats.changes get the leaves they had in that frame without being subdivided again; the leaves are the
+    // same as from analyzing the frame on its own.
+    LeafList Analyze(const FrameStats &stats, const LeafList &previous) const;
+
+    // Whether Analyze needs FrameStats::luma.
+    bool NeedsLuma() const { return mMatcher != nullptr; }
+
+    // Whether Analyze needs the frame in color; otherwise its first channel alone will do.
+    bool NeedsColor() const { return mSubChecker->UsesColor(); }
+
+    void Render(const LeafList &leaves, Image &dst, int phase);
+
+    // Same, also measuring how long each leaf took to render, in nanoseconds.
+    void Render(const LeafList &leaves, Image &dst, int phase, std::vector<float> &leafNs);
+
+    // Same, drawing the leaves top down a band of rows at a time and calling rowsDone with the number of rows from
+    // the top that are final after each band, so they can be encoded while the rest renders.
+    void Render(const LeafList &leaves, Image &dst, int phase, int bandRows, const std::function<void(int)> &rowsDone);
+
+    // Leaves for an in-between frame, t of the way from one analyzed frame to the next. Where the two frames were
+    // subdivided differently the finer subdivision is used, with colors blended from the leaves covering it.
+    LeafList Interpolate(const LeafList &from, const LeafList &to, int width, int height, float t) const;
+
+    // Every leaf size a frame of the given dimensions can produce.
+    std::vector<std::pair<int, int>> GetLeafSizes(int width, int height) const;
+
+  private:
     using ProcResult = std::optional<LeafData>;
 
-    void RenderLeaf(Image &dst, const LeafData &data);
+    struct FrameContext {
+        const FrameStats &stats;
+        LeafList &leaves;
+        int minSize;
+        // Leaves of the previous frame, with the index of the one at each top left corner.
+        const LeafList *previous = nullptr;
+        std::unordered_map<uint64_t, std::size_t> previousAt;
+    };
+
+    void AddLeaf(FrameContext &ctx, LeafData data) const;
+
+    ProcResult Subdivide(FrameContext &ctx, Rect bounds, int depth) const;
+
+    // The node's result and leaves as in the previous frame, or nothing if they might differ.
+    std::optional<ProcResult> ReusePrevious(FrameContext &ctx, Rect bounds) const;
+
+    // Top level cells of a frame, which Analyze subdivides independently.
+    std::vector<Rect> GetRootCells(int width, int height) const;
+
+    // Smallest leaf dimension for frames analyzed at this height: minSize, or more when the output is scaled down,
+    // converted from source pixels.
+    int GetMinSize(int height) const;
 
-    ProcResult ProcessFrame(Image &dst, Rect bounds);
+    // Cells per side a node at this depth splits into.
+    int GetSplit(Rect bounds, int depth, int minSize) const;
 
-    const Image &GetLeaf(Rect bounds);
+    void RenderLeaf(Image &dst, const LeafData &data, int phase);
 
-    std::unique_ptr<std::shared_mutex> mCacheMutex = std::make_unique<std::shared_mutex>();
+    // The leaf's sprite, at its exact size, as the mip level to scale it from or as a distance field.
+    ImageView GetLeaf(const LeafData &data, int phase);
 
-    std::map<std::pair<int, int>, Image> mLeafCache;
-    Image mLeafImage;
+    SpriteStore::Ptr mStore;
     QuadtreeParameters mParams;
     SubdivisionChecker::Ptr mSubChecker;
+    SpriteMatcher::Ptr mMatcher;
 };
 
 SubdivisionChecker::Ptr CreateSubdivisionChecker(const BWParameters &params);
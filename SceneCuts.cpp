@@ -0,0 +1,43 @@
+#include "SceneCuts.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr int gridSize = 16;
+} // namespace
+
+FrameSignature ComputeFrameSignature(const IntegralImage &sums) {
+    FrameSignature sig{};
+    int blocks = 0;
+    for (int j = 0; j < gridSize; ++j) {
+        for (int i = 0; i < gridSize; ++i) {
+            int x0 = sums.Width() * i / gridSize;
+            int y0 = sums.Height() * j / gridSize;
+            Rect block{x0, y0, sums.Width() * (i + 1) / gridSize - x0, sums.Height() * (j + 1) / gridSize - y0};
+            if (block.w <= 0 || block.h <= 0) {
+                continue;
+            }
+            // BT.709 weights in 8-bit fixed point, as Image::lumaNew weighs each pixel.
+            double sum = sums.Sum(block, 0);
+            if (sums.Channels() >= 3) {
+                sum = (54 * sum + 183.0 * sums.Sum(block, 1) + 19.0 * sums.Sum(block, 2)) / 256;
+            }
+            auto mean = std::min(static_cast<std::size_t>(sum / (block.w * block.h)), std::size_t{255});
+            sig.histogram[mean * sig.histogram.size() / 256] += 1;
+            ++blocks;
+        }
+    }
+    for (auto &bin : sig.histogram) {
+        bin /= static_cast<float>(std::max(blocks, 1));
+    }
+    return sig;
+}
+
+double SignatureDistance(const FrameSignature &a, const FrameSignature &b) {
+    double distance = 0;
+    for (std::size_t i = 0; i < a.histogram.size(); ++i) {
+        distance += std::abs(a.histogram[i] - b.histogram[i]);
+    }
+    return distance;
+}
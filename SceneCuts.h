@@ -0,0 +1,22 @@
+#ifndef SCENECUTS_H
+#define SCENECUTS_H
+
+#include "IntegralImage.h"
+
+#include <array>
+
+// Cheap per-frame summary used to find scene cuts.
+struct FrameSignature {
+    // Histogram of the luminance means of a fixed grid of blocks, normalized to sum to 1.
+    std::array<float, 32> histogram;
+};
+
+// From the per-channel sums analysis builds for the frame anyway, so finding cuts costs no extra pass over the pixels.
+// Frames with fewer than three channels use their first as luminance.
+FrameSignature ComputeFrameSignature(const IntegralImage &sums);
+
+// L1 distance between the block-mean histograms of two frames, from 0 to 2. Neighbouring frames further apart than a
+// threshold are taken to be on either side of a scene cut.
+double SignatureDistance(const FrameSignature &a, const FrameSignature &b);
+
+#endif
@@ -0,0 +1,183 @@
+#include "ScopeTrace.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+std::atomic<bool> gScopeTraceEnabled = false;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+    const char *name;
+    // Nanoseconds since tracing was enabled.
+    int64_t start;
+    int64_t end;
+};
+
+// Written by its own thread only, so recording takes no locks; written counts every scope ever recorded, and the
+// slot of scope i is i modulo the (power of two) size.
+struct Ring {
+    explicit Ring(std::size_t size, int thread) : events(size), thread(thread) {}
+
+    std::vector<Event> events;
+    std::atomic<uint64_t> written = 0;
+    int thread;
+};
+
+struct Registry {
+    std::mutex mutex;
+    // Rings outlive their threads so scopes of finished threads still get flushed.
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::size_t ringSize = 1 << 16;
+    Clock::time_point epoch;
+};
+
+Registry &GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+Ring &ThreadRing() {
+    thread_local std::shared_ptr<Ring> ring = [] {
+        auto &registry = GetRegistry();
+        std::lock_guard lock(registry.mutex);
+        auto created = std::make_shared<Ring>(registry.ringSize, static_cast<int>(registry.rings.size()));
+        registry.rings.push_back(created);
+        return created;
+    }();
+    return *ring;
+}
+
+// Little endian, like leaf traces.
+template <class T> void Put(std::vector<char> &out, T value) {
+    auto v = static_cast<uint64_t>(value);
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+}
+
+constexpr char Magic[8] = {'Q', 'T', 'S', 'C', 'O', 'P', 'E', '1'};
+} // namespace
+
+void RecordScope(const char *name, Clock::time_point start, Clock::time_point end) {
+    auto &ring = ThreadRing();
+    auto epoch = GetRegistry().epoch;
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    ring.events[index & (ring.events.size() - 1)] = {
+        name, std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - epoch).count()};
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+void EnableScopeTrace(std::size_t ringSize) {
+    auto &registry = GetRegistry();
+    {
+        std::lock_guard lock(registry.mutex);
+        registry.ringSize = std::bit_ceil(std::max<std::size_t>(ringSize, 1));
+        registry.epoch = Clock::now();
+    }
+    gScopeTraceEnabled.store(true, std::memory_order_release);
+}
+
+bool FlushScopeTrace(const std::string &path) {
+    struct ThreadEvents {
+        int thread;
+        std::vector<Event> events;
+    };
+
+    std::vector<ThreadEvents> threads;
+    {
+        auto &registry = GetRegistry();
+        std::lock_guard lock(registry.mutex);
+        for (const auto &ring : registry.rings) {
+            uint64_t written = ring->written.load(std::memory_order_acquire);
+            uint64_t size = ring->events.size();
+            ThreadEvents copy{ring->thread, {}};
+            for (uint64_t i = written > size ? written - size : 0; i < written; ++i) {
+                copy.events.push_back(ring->events[i & (size - 1)]);
+            }
+            threads.push_back(std::move(copy));
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+
+    auto extension = std::filesystem::path(path).extension();
+    if (extension == ".json") {
+        // Chrome's trace event format, for chrome://tracing and Perfetto; times are in microseconds.
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto &thread : threads) {
+            for (const auto &event : thread.events) {
+                out << std::format("{}\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},"
+                                   "\"dur\":{:.3f}}}",
+                                   first ? "" : ",", event.name, thread.thread, event.start / 1000.0,
+                                   (event.end - event.start) / 1000.0);
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+    } else if (extension == ".bin") {
+        // Magic, then the names, then for each thread its index, scope count and scopes of a 16-bit name index, a
+        // 64-bit start and a 64-bit duration in nanoseconds.
+        std::map<const char *, uint16_t> nameIndex;
+        std::vector<const char *> names;
+        for (const auto &thread : threads) {
+            for (const auto &event : thread.events) {
+                if (nameIndex.emplace(event.name, static_cast<uint16_t>(names.size())).second) {
+                    names.push_back(event.name);
+                }
+            }
+        }
+        // Name indices and lengths are 16-bit.
+        constexpr std::size_t maxNames = std::size_t{std::numeric_limits<uint16_t>::max()} + 1;
+        if (names.size() > maxNames || std::any_of(names.begin(), names.end(), [](const char *name) {
+                return std::string_view(name).size() > std::numeric_limits<uint16_t>::max();
+            })) {
+            return false;
+        }
+
+        std::vector<char> data(std::begin(Magic), std::end(Magic));
+        Put<uint32_t>(data, static_cast<uint32_t>(names.size()));
+        for (const char *name : names) {
+            std::string_view view(name);
+            Put<uint16_t>(data, static_cast<uint16_t>(view.size()));
+            data.insert(data.end(), view.begin(), view.end());
+        }
+        Put<uint32_t>(data, static_cast<uint32_t>(threads.size()));
+        for (const auto &thread : threads) {
+            Put<uint32_t>(data, static_cast<uint32_t>(thread.thread));
+            Put<uint32_t>(data, static_cast<uint32_t>(thread.events.size()));
+            for (const auto &event : thread.events) {
+                Put<uint16_t>(data, nameIndex[event.name]);
+                Put<uint64_t>(data, static_cast<uint64_t>(event.start));
+                Put<uint64_t>(data, static_cast<uint64_t>(event.end - event.start));
+            }
+        }
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    } else {
+        out << "thread\tname\tstart_us\tduration_us\n";
+        for (const auto &thread : threads) {
+            for (const auto &event : thread.events) {
+                out << std::format("{}\t{}\t{:.3f}\t{:.3f}\n", thread.thread, event.name, event.start / 1000.0,
+                                   (event.end - event.start) / 1000.0);
+            }
+        }
+    }
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,70 @@
+#ifndef SCOPETRACE_H
+#define SCOPETRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Named timing scopes: TRACE_SCOPE("Image::halveNew"); at the top of a block records when the block was entered and
+// left. Without AMOGUIFIER_TRACE_SCOPES (the CMake option of the same name) the macro compiles to nothing. With it,
+// scopes cost one load until EnableScopeTrace is called, and two clock reads and a store into the calling thread's
+// ring buffer after that. Names must be string literals; only the pointer is kept.
+
+#define TRACE_SCOPE_CONCAT_(a, b) a##b
+#define TRACE_SCOPE_CONCAT(a, b) TRACE_SCOPE_CONCAT_(a, b)
+
+#ifdef AMOGUIFIER_TRACE_SCOPES
+#define TRACE_SCOPE(name) ScopeTimer TRACE_SCOPE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#endif
+
+extern std::atomic<bool> gScopeTraceEnabled;
+
+// Appends to the calling thread's ring, overwriting its oldest scope once the ring is full.
+void RecordScope(const char *name, std::chrono::steady_clock::time_point start,
+                 std::chrono::steady_clock::time_point end);
+
+class ScopeTimer {
+  public:
+    explicit ScopeTimer(const char *name)
+        : mName(gScopeTraceEnabled.load(std::memory_order_acquire) ? name : nullptr) {
+        if (mName) {
+            mStart = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopeTimer() {
+        if (mName) {
+            RecordScope(mName, mStart, std::chrono::steady_clock::now());
+        }
+    }
+
+    ScopeTimer(const ScopeTimer &) = delete;
+    ScopeTimer &operator=(const ScopeTimer &) = delete;
+
+  private:
+    const char *mName;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+// Whether TRACE_SCOPE was compiled in.
+constexpr bool ScopeTraceCompiled() {
+#ifdef AMOGUIFIER_TRACE_SCOPES
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Starts recording, keeping up to ringSize scopes per thread.
+void EnableScopeTrace(std::size_t ringSize = 1 << 16);
+
+// Writes every thread's recorded scopes, oldest first per thread, as Chrome trace event JSON (.json), a compact
+// binary file (.bin) or one line of text per scope (anything else). Call it once the traced threads are idle; scopes
+// still being recorded may be cut off. Returns false if the file can't be written, or for .bin if there are more
+// distinct scope names or longer ones than its 16-bit fields hold.
+bool FlushScopeTrace(const std::string &path);
+
+#endif
@@ -0,0 +1,105 @@
+#include "SpriteMatcher.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <limits>
+
+namespace {
+constexpr int gridSize = 4;
+constexpr int cellCount = gridSize * gridSize;
+constexpr int maskCount = 1 << cellCount;
+
+// Splits cell means into a mask of the cells that are brighter than the average cell.
+uint16_t ToMask(const std::array<uint32_t, cellCount> &means) {
+    uint32_t total = 0;
+    for (auto m : means) {
+        total += m;
+    }
+
+    uint16_t mask = 0;
+    for (int i = 0; i < cellCount; ++i) {
+        if (means[i] * cellCount > total) {
+            mask |= static_cast<uint16_t>(1 << i);
+        }
+    }
+    return mask;
+}
+
+std::array<int, gridSize + 1> CellEdges(int pos, int size) {
+    std::array<int, gridSize + 1> edges;
+    for (int i = 0; i <= gridSize; ++i) {
+        edges[i] = pos + size * i / gridSize;
+    }
+    return edges;
+}
+} // namespace
+
+SpriteMatcher::SpriteMatcher(SpriteStore::Ptr sprites, int minContrast)
+    : mSprites(std::move(sprites)), mNearest(maskCount), mMinContrast(minContrast) {
+    std::vector<uint16_t> descriptors;
+    for (int i = 0; i < mSprites->FrameCount(); ++i) {
+        descriptors.push_back(Describe(mSprites->GetImage(i)));
+    }
+
+    for (int mask = 0; mask < maskCount; ++mask) {
+        int best = 0;
+        int bestDistance = std::numeric_limits<int>::max();
+        for (std::size_t i = 0; i < descriptors.size(); ++i) {
+            int distance = std::popcount(static_cast<unsigned>(mask ^ descriptors[i]));
+            if (distance < bestDistance) {
+                best = static_cast<int>(i);
+                bestDistance = distance;
+            }
+        }
+        mNearest[mask] = static_cast<uint16_t>(best);
+    }
+}
+
+std::optional<int> SpriteMatcher::Match(const IntegralImage &luma, Rect bounds) const {
+    if (bounds.w < gridSize || bounds.h < gridSize) {
+        return std::nullopt;
+    }
+
+    auto xs = CellEdges(bounds.x, bounds.w);
+    auto ys = CellEdges(bounds.y, bounds.h);
+
+    std::array<uint32_t, cellCount> means;
+    for (int j = 0; j < gridSize; ++j) {
+        for (int i = 0; i < gridSize; ++i) {
+            Rect cell{xs[i], ys[j], xs[i + 1] - xs[i], ys[j + 1] - ys[j]};
+            means[i + j * gridSize] = luma.Sum(cell, 0) / static_cast<uint32_t>(cell.w * cell.h);
+        }
+    }
+
+    auto [lo, hi] = std::minmax_element(means.begin(), means.end());
+    if (static_cast<int>(*hi - *lo) < mMinContrast) {
+        return std::nullopt;
+    }
+
+    return mNearest[ToMask(means)];
+}
+
+uint16_t SpriteMatcher::Describe(ImageView sprite) {
+    auto xs = CellEdges(0, sprite.width);
+    auto ys = CellEdges(0, sprite.height);
+
+    // Coverage is the light the sprite contributes once tinted: its luminance weighted by its alpha.
+    std::array<uint32_t, cellCount> means;
+    for (int j = 0; j < gridSize; ++j) {
+        for (int i = 0; i < gridSize; ++i) {
+            uint64_t sum = 0;
+            for (int y = ys[j]; y < ys[j + 1]; ++y) {
+                for (int x = xs[i]; x < xs[i + 1]; ++x) {
+                    const byte *p = sprite.pixel(x, y);
+                    uint32_t lum = sprite.channels < 3 ? p[0] : (54 * p[0] + 183 * p[1] + 19 * p[2]) >> 8;
+                    uint32_t alpha = sprite.channels == 4 || sprite.channels == 2 ? p[sprite.channels - 1] : 255;
+                    sum += lum * alpha / 255;
+                }
+            }
+            auto area = static_cast<uint64_t>(xs[i + 1] - xs[i]) * (ys[j + 1] - ys[j]);
+            means[i + j * gridSize] = area ? static_cast<uint32_t>(sum / area) : 0;
+        }
+    }
+    return ToMask(means);
+}
@@ -0,0 +1,36 @@
+#ifndef SPRITEMATCHER_H
+#define SPRITEMATCHER_H
+
+#include "IntegralImage.h"
+#include "SpriteStore.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Picks, for each leaf, the sprite whose coverage pattern best matches the leaf's content.
+//
+// Every sprite and every leaf is reduced to a 4x4 grid of cell means, thresholded against the overall mean into a
+// 16-bit mask. The nearest sprite (by Hamming distance) for each of the 65536 possible masks is precomputed, so a
+// match is one table lookup once the leaf's mask is known.
+class SpriteMatcher {
+  public:
+    using Ptr = std::shared_ptr<SpriteMatcher>;
+
+    SpriteMatcher(SpriteStore::Ptr sprites, int minContrast);
+
+    // Returns the best matching sprite for the leaf, or nothing if the leaf is too flat to have a pattern.
+    std::optional<int> Match(const IntegralImage &luma, Rect bounds) const;
+
+    SpriteStore &GetSprites() const { return *mSprites; }
+
+  private:
+    static uint16_t Describe(ImageView sprite);
+
+    SpriteStore::Ptr mSprites;
+    std::vector<uint16_t> mNearest;
+    int mMinContrast;
+};
+
+#endif
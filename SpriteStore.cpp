@@ -0,0 +1,431 @@
+#include "SpriteStore.h"
+
+#include "ScopeTrace.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SPRITESTORE_SHARED_MEMORY
+#endif
+
+namespace {
+// Longest side of a distance field. Sprite silhouettes are smooth enough that this keeps their edges within a pixel
+// at every leaf size the sprites are scaled down to.
+constexpr int fieldSide = 128;
+
+#ifdef SPRITESTORE_SHARED_MEMORY
+constexpr uint32_t segmentMagic = 0x53415451; // "QTAS"
+constexpr uint32_t segmentVersion = 4;
+// Values of SegmentHeader::ready.
+constexpr uint32_t segmentReady = 1;
+constexpr uint32_t segmentAbandoned = 2;
+constexpr std::size_t segmentAlignment = 64;
+// The publisher sizes a segment right after creating it, but may take a while to fill it in.
+constexpr auto sizeTimeout = std::chrono::seconds(1);
+constexpr auto attachTimeout = std::chrono::seconds(60);
+
+// The fingerprint and publisher are written as soon as the segment is created, the counts once it's filled in.
+struct SegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    // Set by the publisher once everything else in the segment has been written, or when it gives up.
+    std::atomic<uint32_t> ready;
+    uint32_t frameCount;
+    uint64_t fingerprint;
+    uint64_t entryCount;
+    // Distinct frames, which entries refer to; the frame to slot table follows the entries.
+    uint32_t slotCount;
+    // Process id of the publisher, so attaching processes can tell when it died before setting ready.
+    int32_t publisher;
+};
+
+struct SegmentEntry {
+    int32_t slot;
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    // The full size frame rather than a resized leaf.
+    uint32_t base;
+    uint32_t padding;
+    uint64_t offset;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "segment readiness flag must be usable across processes");
+
+std::size_t Align(std::size_t offset) { return (offset + segmentAlignment - 1) / segmentAlignment * segmentAlignment; }
+
+void Warn(const std::string &name, const std::string &problem) {
+    std::cerr << "Shared sprites '" << name << "' " << problem << ".\n";
+}
+
+// Unlinks the segment fd refers to, unless the name has meanwhile been taken by a new one.
+void UnlinkIfCurrent(const std::string &name, int fd) {
+    int current = shm_open(name.c_str(), O_RDONLY, 0);
+    if (current < 0) {
+        return;
+    }
+    struct stat ours {};
+    struct stat theirs {};
+    bool same = fstat(fd, &ours) == 0 && fstat(current, &theirs) == 0 && ours.st_dev == theirs.st_dev &&
+                ours.st_ino == theirs.st_ino;
+    close(current);
+    if (same) {
+        shm_unlink(name.c_str());
+    }
+}
+#endif
+} // namespace
+
+SpriteStore::Ptr SpriteStore::Load(const std::vector<std::string> &paths) {
+    TRACE_SCOPE("SpriteStore::Load");
+    if (paths.empty()) {
+        return nullptr;
+    }
+
+    Ptr store(new SpriteStore());
+    // Decoded pixels of each distinct frame, kept until every file has been compared against them.
+    std::vector<Image> decoded;
+    std::unordered_multimap<uint64_t, int> slotsByHash;
+    for (const auto &path : paths) {
+        Image sprite{path.c_str()};
+        auto hash = sprite.hashPixels();
+        int slot = -1;
+        for (auto [it, end] = slotsByHash.equal_range(hash); it != end; ++it) {
+            if (decoded[it->second].samePixels(sprite)) {
+                slot = it->second;
+                break;
+            }
+        }
+
+        if (slot < 0) {
+            slot = static_cast<int>(store->mFrames.size());
+            slotsByHash.emplace(hash, slot);
+            decoded.push_back(sprite);
+            sprite.rescaleLuminance();
+            auto &f = store->mFrames.emplace_back();
+            f.cache.emplace(std::move(sprite));
+            f.image = f.cache->GetImage().view();
+        }
+        store->mSlots.push_back(slot);
+    }
+    return store;
+}
+
+#ifdef SPRITESTORE_SHARED_MEMORY
+struct SpriteStore::Claim {
+    std::string name;
+    int fd = -1;
+    SegmentHeader *header = nullptr;
+    bool published = false;
+
+    ~Claim() {
+        if (!published) {
+            header->ready.store(segmentAbandoned, std::memory_order_release);
+            UnlinkIfCurrent(name, fd);
+        }
+        munmap(header, sizeof(SegmentHeader));
+        close(fd);
+    }
+};
+#else
+struct SpriteStore::Claim {};
+#endif
+
+SpriteStore::Ptr SpriteStore::Attach(const std::string &name, uint64_t fingerprint, std::shared_ptr<Claim> &claim) {
+    TRACE_SCOPE("SpriteStore::Attach");
+#ifdef SPRITESTORE_SHARED_MEMORY
+    // Whichever process creates the segment publishes it; the rest only ever open it. Each stale segment replaced lets
+    // another process race for the name again, so give up after a few.
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 && errno != EEXIST) {
+            Warn(name, std::string("can't be created: ") + std::strerror(errno));
+            return nullptr;
+        }
+        if (fd < 0) {
+            bool stale = false;
+            if (auto store = Open(name, fingerprint, stale); store || !stale) {
+                return store;
+            }
+            continue;
+        }
+
+        // Sized and stamped with the publisher right away, so waiting processes can tell when it exits unfinished.
+        void *mem = MAP_FAILED;
+        if (ftruncate(fd, sizeof(SegmentHeader)) == 0) {
+            mem = mmap(nullptr, sizeof(SegmentHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (mem == MAP_FAILED) {
+            Warn(name, std::string("can't be created: ") + std::strerror(errno));
+            close(fd);
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+        auto *header = new (mem) SegmentHeader{
+            segmentMagic, segmentVersion, {0}, 0, fingerprint, 0, 0, static_cast<int32_t>(getpid())};
+        claim = std::make_shared<Claim>();
+        claim->name = name;
+        claim->fd = fd;
+        claim->header = header;
+        return nullptr;
+    }
+    Warn(name, "keep being replaced");
+    return nullptr;
+#else
+    (void)name;
+    (void)fingerprint;
+    (void)claim;
+    std::cerr << "Shared sprites aren't supported on this platform.\n";
+    return nullptr;
+#endif
+}
+
+SpriteStore::Ptr SpriteStore::Open(const std::string &name, uint64_t fingerprint, bool &stale) {
+#ifdef SPRITESTORE_SHARED_MEMORY
+    // Replaced between the failed create and now: race for the name again.
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        stale = errno == ENOENT;
+        if (!stale) {
+            Warn(name, std::string("can't be opened: ") + std::strerror(errno));
+        }
+        return nullptr;
+    }
+
+    // The publisher sizes the segment right after creating it, and sizes it again to fill it in.
+    auto start = std::chrono::steady_clock::now();
+    struct stat st {};
+    while (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) < sizeof(SegmentHeader) &&
+           std::chrono::steady_clock::now() < start + sizeTimeout) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (static_cast<std::size_t>(st.st_size) < sizeof(SegmentHeader)) {
+        close(fd);
+        Warn(name, "were never filled in");
+        return nullptr;
+    }
+    void *mem = mmap(nullptr, sizeof(SegmentHeader), PROT_READ, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        close(fd);
+        Warn(name, std::string("can't be mapped: ") + std::strerror(errno));
+        return nullptr;
+    }
+    std::shared_ptr<void> headerMapping(mem, [](void *p) { munmap(p, sizeof(SegmentHeader)); });
+    const auto *header = static_cast<const SegmentHeader *>(mem);
+
+    auto replace = [&](const std::string &problem) {
+        Warn(name, problem + ", replacing them");
+        UnlinkIfCurrent(name, fd);
+        close(fd);
+        stale = true;
+        return nullptr;
+    };
+    if (header->magic != segmentMagic || header->version != segmentVersion) {
+        close(fd);
+        Warn(name, "were published by an incompatible version");
+        return nullptr;
+    }
+    if (header->fingerprint != fingerprint) {
+        return replace("were published for different animation frames");
+    }
+    for (uint32_t ready; (ready = header->ready.load(std::memory_order_acquire)) != segmentReady;) {
+        if (ready == segmentAbandoned) {
+            return replace("were given up by their publisher");
+        }
+        if (kill(header->publisher, 0) != 0 && errno == ESRCH) {
+            return replace("were left unfinished by a publisher that exited");
+        }
+        if (std::chrono::steady_clock::now() >= start + attachTimeout) {
+            close(fd);
+            Warn(name, "weren't finished in time");
+            return nullptr;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // Ready, so at its final size.
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        Warn(name, std::string("can't be mapped: ") + std::strerror(errno));
+        return nullptr;
+    }
+    auto size = static_cast<std::size_t>(st.st_size);
+    mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        Warn(name, std::string("can't be mapped: ") + std::strerror(errno));
+        return nullptr;
+    }
+
+    Ptr store(new SpriteStore());
+    store->mMapping = std::shared_ptr<void>(mem, [size](void *p) { munmap(p, size); });
+    header = static_cast<const SegmentHeader *>(mem);
+    if (sizeof(SegmentHeader) + header->entryCount * sizeof(SegmentEntry) + header->frameCount * sizeof(int32_t) >
+        size) {
+        Warn(name, "are corrupt");
+        return nullptr;
+    }
+
+    const auto *entries =
+        reinterpret_cast<const SegmentEntry *>(static_cast<const byte *>(mem) + sizeof(SegmentHeader));
+    const auto *slots = reinterpret_cast<const int32_t *>(entries + header->entryCount);
+    store->mFrames.resize(header->slotCount);
+    for (uint32_t i = 0; i < header->frameCount; ++i) {
+        if (slots[i] < 0 || slots[i] >= static_cast<int32_t>(header->slotCount)) {
+            Warn(name, "are corrupt");
+            return nullptr;
+        }
+        store->mSlots.push_back(slots[i]);
+    }
+    for (uint64_t i = 0; i < header->entryCount; ++i) {
+        const auto &e = entries[i];
+        auto bytes = static_cast<std::size_t>(e.width) * e.height * e.channels;
+        if (e.slot < 0 || e.slot >= static_cast<int32_t>(header->slotCount) || e.offset + bytes > size) {
+            Warn(name, "are corrupt");
+            return nullptr;
+        }
+
+        ImageView view{static_cast<const byte *>(mem) + e.offset, e.width, e.height, e.channels};
+        if (e.base) {
+            store->mFrames[e.slot].image = view;
+        } else {
+            store->mShared.emplace(std::make_tuple(e.slot, e.width, e.height), view);
+        }
+    }
+    for (const auto &frame : store->mFrames) {
+        if (!frame.image.data) {
+            Warn(name, "are corrupt");
+            return nullptr;
+        }
+    }
+    return store;
+#else
+    (void)name;
+    (void)fingerprint;
+    (void)stale;
+    return nullptr;
+#endif
+}
+
+bool SpriteStore::Publish(Claim &claim, const std::vector<std::pair<int, int>> &sizes) {
+    TRACE_SCOPE("SpriteStore::Publish");
+#ifdef SPRITESTORE_SHARED_MEMORY
+    std::vector<SegmentEntry> entries;
+    std::vector<ImageView> views;
+    std::vector<bool> published(mFrames.size());
+    for (int frame = 0; frame < FrameCount(); ++frame) {
+        int slot = mSlots[frame];
+        if (published[slot]) {
+            continue;
+        }
+        published[slot] = true;
+        views.push_back(GetImage(frame));
+        entries.push_back({slot, views.back().width, views.back().height, views.back().channels, 1, 0, 0});
+        for (auto [w, h] : sizes) {
+            if (w > 0 && h > 0) {
+                views.push_back(GetLeaf(frame, w, h));
+                entries.push_back({slot, w, h, views.back().channels, 0, 0, 0});
+            }
+        }
+    }
+
+    std::size_t slotsOffset = sizeof(SegmentHeader) + entries.size() * sizeof(SegmentEntry);
+    std::size_t size = Align(slotsOffset + mSlots.size() * sizeof(int32_t));
+    for (auto &e : entries) {
+        e.offset = size;
+        size = Align(size + static_cast<std::size_t>(e.width) * e.height * e.channels);
+    }
+
+    // Waiting processes only look past the header once ready is set, so it can grow under them.
+    const std::string &name = claim.name;
+    void *mem = MAP_FAILED;
+    if (ftruncate(claim.fd, static_cast<off_t>(size)) == 0) {
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, claim.fd, 0);
+    }
+    if (mem == MAP_FAILED) {
+        Warn(name, std::string("can't be filled in: ") + std::strerror(errno));
+        return false;
+    }
+
+    auto *header = static_cast<SegmentHeader *>(mem);
+    header->frameCount = static_cast<uint32_t>(FrameCount());
+    header->entryCount = entries.size();
+    header->slotCount = static_cast<uint32_t>(mFrames.size());
+    std::memcpy(static_cast<byte *>(mem) + sizeof(SegmentHeader), entries.data(),
+                entries.size() * sizeof(SegmentEntry));
+    std::vector<int32_t> slots(mSlots.begin(), mSlots.end());
+    std::memcpy(static_cast<byte *>(mem) + slotsOffset, slots.data(), slots.size() * sizeof(int32_t));
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        std::memcpy(static_cast<byte *>(mem) + entries[i].offset, views[i].data,
+                    static_cast<std::size_t>(views[i].width) * views[i].height * views[i].channels);
+    }
+    header->ready.store(segmentReady, std::memory_order_release);
+    claim.published = true;
+
+    munmap(mem, size);
+    return true;
+#else
+    (void)claim;
+    (void)sizes;
+    return false;
+#endif
+}
+
+ImageView SpriteStore::GetImage(int frame) const { return mFrames[mSlots[frame]].image; }
+
+ImageView SpriteStore::GetLeaf(int frame, int w, int h) {
+    int slot = mSlots[frame];
+    if (!mShared.empty()) {
+        auto it = mShared.find(std::make_tuple(slot, w, h));
+        if (it != mShared.end()) {
+            return it->second;
+        }
+    }
+
+    // Attached stores only copy a frame out of the segment once a size it doesn't have is asked for.
+    auto &f = mFrames[slot];
+    std::call_once(*f.cacheOnce, [&f] {
+        if (!f.cache) {
+            f.cache.emplace(Image{f.image});
+        }
+    });
+    return f.cache->Get(w, h).view();
+}
+
+ImageView SpriteStore::GetMip(int frame, int w, int h) {
+    auto &f = mFrames[mSlots[frame]];
+    std::call_once(*f.mipsOnce, [&f] {
+        Image level{f.image};
+        while (level.width() > 1 || level.height() > 1) {
+            level = level.halveNew();
+            f.mips.push_back(level);
+        }
+    });
+
+    ImageView best = f.image;
+    for (const auto &mip : f.mips) {
+        if (mip.width() < w || mip.height() < h) {
+            break;
+        }
+        best = mip.view();
+    }
+    return best;
+}
+
+ImageView SpriteStore::GetField(int frame) {
+    auto &f = mFrames[mSlots[frame]];
+    std::call_once(*f.fieldOnce, [&f] { f.field = Image{f.image}.distanceFieldNew(fieldSide); });
+    return f.field->view();
+}
@@ -0,0 +1,84 @@
+#ifndef SPRITESTORE_H
+#define SPRITESTORE_H
+
+#include "Image.h"
+#include "LeafCache.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Every animation frame together with its resized copies, shared by all frames being processed so each frame and leaf
+// size is only ever resized once, whichever animation phase asks for it.
+//
+// A store can also be published to a named shared memory segment, so other processes on the same host can attach to
+// it read-only instead of decoding and resizing the same sprites again. Sizes missing from the segment are still
+// resized on demand, locally.
+class SpriteStore {
+  public:
+    using Ptr = std::shared_ptr<SpriteStore>;
+
+    // Decodes the frames and rescales their luminance. Frames that decode to the same pixels, like the held frames of a
+    // walk cycle, are only preprocessed once and share one image and one set of resized leaves.
+    static Ptr Load(const std::vector<std::string> &paths);
+
+    // A segment this process created and so is the one to Publish to. Dropped unpublished, it tells the processes
+    // waiting on the segment to stop and load the sprites themselves.
+    struct Claim;
+
+    // Attaches to the segment, waiting up to a minute for its publisher to finish it. If there is none, claims the
+    // name instead: creating the segment is what elects the publisher, so of several processes starting at once only
+    // one loads the sprites for the rest. A segment is only replaced when its publisher exited or it was claimed for
+    // different sprites. Returns nothing, reporting any problem on std::cerr, when there is nothing to attach to; claim
+    // is then set if this process should publish.
+    static Ptr Attach(const std::string &name, uint64_t fingerprint, std::shared_ptr<Claim> &claim);
+
+    // Copies the frames and the given leaf sizes into the claimed segment and marks it ready. Returns false, reporting
+    // why on std::cerr, if it can't be filled in.
+    bool Publish(Claim &claim, const std::vector<std::pair<int, int>> &sizes);
+
+    int FrameCount() const { return static_cast<int>(mSlots.size()); }
+
+    ImageView GetImage(int frame) const;
+
+    ImageView GetLeaf(int frame, int w, int h);
+
+    // The smallest level of the frame's mip chain that is at least w by h, or the frame itself if none is, for
+    // rendering with Image::blitTintedScaled. The chain is a fixed third of the frame's size whatever the leaf sizes.
+    ImageView GetMip(int frame, int w, int h);
+
+    // The frame as a distance field for Image::blitTintedField, the same small image whatever the leaf sizes.
+    ImageView GetField(int frame);
+
+  private:
+    struct Frame {
+        ImageView image;
+        std::optional<LeafCache> cache;
+        std::unique_ptr<std::once_flag> cacheOnce = std::make_unique<std::once_flag>();
+        // Halved again and again, down to a single pixel.
+        std::vector<Image> mips;
+        std::unique_ptr<std::once_flag> mipsOnce = std::make_unique<std::once_flag>();
+        std::optional<Image> field;
+        std::unique_ptr<std::once_flag> fieldOnce = std::make_unique<std::once_flag>();
+    };
+
+    SpriteStore() = default;
+
+    // Maps a segment someone else created once it's ready. Sets stale if it should be replaced: its publisher exited
+    // or gave up, or it is for other sprites.
+    static Ptr Open(const std::string &name, uint64_t fingerprint, bool &stale);
+
+    // Distinct frames; animation frame i is mFrames[mSlots[i]].
+    std::vector<Frame> mFrames;
+    std::vector<int> mSlots;
+    std::map<std::tuple<int, int, int>, ImageView> mShared;
+    std::shared_ptr<void> mMapping;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "Y4mWriter.h"
+
+#include <iostream>
+
+Y4mWriter::Y4mWriter(const std::string &path, int firstIndex, int fps)
+    : mFile(path, std::ios::binary), mNext(firstIndex), mFps(fps) {}
+
+Y4mWriter::~Y4mWriter() {
+    for (const auto &[index, planes] : mPending) {
+        WriteFrame(planes);
+    }
+}
+
+void Y4mWriter::Write(int index, int width, int height, std::vector<byte> planes) {
+    std::unique_lock lock(mMutex);
+    if (mWidth == 0) {
+        mWidth = width;
+        mHeight = height;
+        // 4:2:0 with chroma centered between the luma samples it averages, progressive, square pixels.
+        mFile << "YUV4MPEG2 W" << width << " H" << height << " F" << mFps << ":1 Ip A1:1 C420jpeg\n";
+    } else if (width != mWidth || height != mHeight) {
+        // Still takes its place in the order, so the frames after it don't wait for it forever.
+        std::cerr << "Dropping frame " << index << " of a different size from the y4m stream\n";
+        planes.clear();
+    }
+    Enqueue(index, std::move(planes));
+}
+
+void Y4mWriter::Skip(int index) {
+    std::unique_lock lock(mMutex);
+    if (index >= mNext) {
+        Enqueue(index, {});
+    }
+}
+
+void Y4mWriter::Enqueue(int index, std::vector<byte> planes) {
+    mPending.emplace(index, std::move(planes));
+    for (auto it = mPending.begin(); it != mPending.end() && it->first <= mNext; it = mPending.erase(it)) {
+        WriteFrame(it->second);
+        mNext = it->first + 1;
+    }
+}
+
+void Y4mWriter::WriteFrame(const std::vector<byte> &planes) {
+    if (planes.empty()) {
+        return;
+    }
+    mFile << "FRAME\n";
+    mFile.write(reinterpret_cast<const char *>(planes.data()), static_cast<std::streamsize>(planes.size()));
+}
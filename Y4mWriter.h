@@ -0,0 +1,44 @@
+#ifndef Y4MWRITER_H
+#define Y4MWRITER_H
+
+#include "Image.h"
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A YUV4MPEG2 stream of 4:2:0 frames, which video encoders read directly. Frames can be written from any thread and
+// in any order; they go out in index order, and frames that arrive ahead of an earlier one wait in memory for it.
+class Y4mWriter {
+  public:
+    Y4mWriter(const std::string &path, int firstIndex, int fps);
+
+    // Writes whatever is still waiting, skipping frames that never arrived.
+    ~Y4mWriter();
+
+    // planes as returned by Image::yuv420New. The first frame written sets the stream's dimensions; frames of any
+    // other size are dropped, as are empty ones.
+    void Write(int index, int width, int height, std::vector<byte> planes);
+
+    // The frame won't be written, e.g. because rendering it failed, so the frames after it needn't wait for it.
+    // Does nothing if it already was.
+    void Skip(int index);
+
+  private:
+    // Queues the frame and writes every queued one that's next in order. Call with mMutex locked.
+    void Enqueue(int index, std::vector<byte> planes);
+
+    void WriteFrame(const std::vector<byte> &planes);
+
+    std::mutex mMutex;
+    std::ofstream mFile;
+    std::map<int, std::vector<byte>> mPending;
+    int mNext;
+    int mFps;
+    int mWidth = 0;
+    int mHeight = 0;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include "SpriteStore.h"
+
+#include <filesystem>
+#include <format>
+#include <string>
+#include <vector>
+
+// Paths of frames start, start + 1, ... of a path pattern, up to the first one missing.
+inline std::vector<std::string> findFrames(const std::string &pattern, int start) {
+    std::vector<std::string> paths;
+    for (int frame = start;; ++frame) {
+        auto path = std::format(pattern, frame);
+        if (!std::filesystem::exists(path) || (!paths.empty() && path == paths.back())) {
+            break;
+        }
+        paths.push_back(std::move(path));
+    }
+    return paths;
+}
+
+// Loads frames start, start + 1, ... of a path pattern as sprites, the same way the main executable does.
+inline SpriteStore::Ptr loadSprites(const std::string &pattern, int start) {
+    return SpriteStore::Load(findFrames(pattern, start));
+}
+
+#endif
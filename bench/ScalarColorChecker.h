@@ -0,0 +1,46 @@
+#ifndef SCALARCOLORCHECKER_H
+#define SCALARCOLORCHECKER_H
+
+#include "Quadtree.h"
+
+#include <algorithm>
+#include <span>
+#include <tuple>
+
+// The scalar Merge as it was, for reference.
+class ScalarColorChecker : public SubdivisionChecker {
+  public:
+    ScalarColorChecker(const ColorParameters &params) : mParams(params) {}
+
+    RgbColor GetColor(const IntegralImage &, Rect) const override { return {}; }
+
+    std::tuple<bool, RgbColor> Merge(const RgbColor &tl, const RgbColor &tr, const RgbColor &bl,
+                                     const RgbColor &br) const override {
+        auto sqr = [](auto x) { return x * x; };
+        auto thresh2 = 3 * sqr(mParams.similarityThreshold);
+
+        auto diff2 = [&](const RgbColor &x, const RgbColor &y) {
+            return sqr(x.r - y.r) + sqr(x.g - y.g) + sqr(x.b - y.b);
+        };
+
+        int maxDiff = 0;
+        for (const auto &d :
+             {diff2(tl, tr), diff2(tl, bl), diff2(tl, br), diff2(tr, bl), diff2(tr, br), diff2(bl, br)}) {
+            maxDiff = std::max(d, maxDiff);
+        }
+
+        byte r = static_cast<byte>((tl.r + tr.r + bl.r + br.r) / 4);
+        byte g = static_cast<byte>((tl.g + tr.g + bl.g + br.g) / 4);
+        byte b = static_cast<byte>((tl.b + tr.b + bl.b + br.b) / 4);
+
+        return std::make_pair(maxDiff < thresh2, RgbColor{r, g, b});
+    }
+
+    // Only the 2x2 test is compared.
+    std::tuple<bool, RgbColor> MergeAll(std::span<const RgbColor>) const override { return {false, {}}; }
+
+  private:
+    ColorParameters mParams;
+};
+
+#endif
@@ -0,0 +1,87 @@
+// Times SubdivisionColor::Merge, the test every internal node of every frame goes through, against the scalar version
+// it replaced. tests/test_merge.cpp checks that the two agree.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "Quadtree.h"
+#include "ScalarColorChecker.h"
+#include "lib/cxxopts.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps the timed merges from being optimized away.
+volatile int sink;
+
+using Quad = std::array<RgbColor, 4>;
+
+// Quads like the ones analysis produces: mostly close colors, with an edge through some of them.
+std::vector<Quad> makeQuads(std::size_t count) {
+    std::mt19937 rng(2);
+    std::vector<Quad> quads(count);
+    for (auto &q : quads) {
+        RgbColor base{static_cast<byte>(rng()), static_cast<byte>(rng()), static_cast<byte>(rng())};
+        bool edge = rng() % 4 == 0;
+        for (auto &color : q) {
+            int spread = edge ? 255 : 16;
+            auto jitter = [&](byte v) {
+                return static_cast<byte>(std::clamp(v + static_cast<int>(rng() % (spread + 1)) - spread / 2, 0, 255));
+            };
+            color = {jitter(base.r), jitter(base.g), jitter(base.b)};
+        }
+    }
+    return quads;
+}
+
+double timeMerges(const SubdivisionChecker &checker, const std::vector<Quad> &quads, int iterations) {
+    int merged = 0;
+    auto start = Clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        for (const auto &q : quads) {
+            auto [merge, color] = checker.Merge(q[0], q[1], q[2], q[3]);
+            merged += merge + color.r;
+        }
+    }
+    sink = merged;
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() /
+           (static_cast<double>(quads.size()) * iterations);
+}
+
+int main(int argc, char *argv[]) {
+    cxxopts::Options optParser("bench_merge", "Times the color subdivision merge test.");
+    // clang-format off
+    optParser.add_options()
+        ("n,count", "Quads per timed pass", cxxopts::value<int>()->default_value("1000000"))
+        ("i,iterations", "Timed passes", cxxopts::value<int>()->default_value("20"))
+        ("s,similarity", "Similarity threshold (0-255)", cxxopts::value<int>()->default_value("8"))
+        ("h,help", "Print usage");
+    // clang-format on
+
+    auto options = optParser.parse(argc, argv);
+    if (options.count("help")) {
+        std::cout << optParser.help() << std::endl;
+        return 0;
+    }
+
+    auto quads = makeQuads(static_cast<std::size_t>(std::max(options["count"].as<int>(), 1)));
+    int iterations = std::max(options["iterations"].as<int>(), 1);
+    ColorParameters params{options["similarity"].as<int>()};
+    auto fast = CreateSubdivisionChecker(params);
+    ScalarColorChecker scalar(params);
+
+    // Warm up both before timing either.
+    timeMerges(*fast, quads, 1);
+    timeMerges(scalar, quads, 1);
+    double fastNs = timeMerges(*fast, quads, iterations);
+    double scalarNs = timeMerges(scalar, quads, iterations);
+
+    std::cout << std::format("scalar  {:.2f} ns/merge\n", scalarNs);
+    std::cout << std::format("current {:.2f} ns/merge ({:.2f}x)\n", fastNs, scalarNs / fastNs);
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Replays leaf traces recorded with --record-trace through Quadtree::Render alone: no decoding, analysis or saving.
+// The first pass over the trace builds the sprite caches and is reported separately; the passes after it are timed
+// per frame.
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "Image.h"
+#include "LeafTrace.h"
+#include "Quadtree.h"
+#include "lib/cxxopts.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+double renderAll(std::vector<Quadtree> &trees, const std::vector<TracedFrame> &frames, std::vector<Image> &targets,
+                 std::vector<double> *frameTimes) {
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        const auto &frame = frames[i];
+        auto frameStart = Clock::now();
+        trees[frame.variant].Render(frame.leaves, targets[i], frame.phase);
+        if (frameTimes) {
+            frameTimes->push_back(std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count());
+        }
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    cxxopts::Options optParser("bench_render", "Replays recorded leaf traces through the renderer only.");
+    // clang-format off
+    optParser.add_options()
+        ("trace", "Trace recorded with QuadtreeAmoguifier --record-trace", cxxopts::value<std::string>())
+        ("a,anim", "Path pattern to the animation frames", cxxopts::value<std::string>()->default_value("res/{}.png"))
+        ("anim-start", "First frame index of animation frames", cxxopts::value<int>()->default_value("0"))
+        ("match", "Frames matched leaves were picked from, if the job used --match with its own frames (defaults to --anim)", cxxopts::value<std::string>())
+        ("match-start", "First frame index of --match frames", cxxopts::value<int>()->default_value("0"))
+        ("n,iterations", "Timed passes over the whole trace", cxxopts::value<int>()->default_value("5"))
+        ("mip-sprites", "Render with --mip-sprites whether or not the trace was recorded with it")
+        ("field-sprites", "Render with --field-sprites whether or not the trace was recorded with it")
+        ("h,help", "Print usage");
+    // clang-format on
+    optParser.parse_positional({"trace"});
+    optParser.positional_help("<trace>");
+
+    auto options = optParser.parse(argc, argv);
+    if (options.count("help") || !options.count("trace")) {
+        std::cout << optParser.help() << std::endl;
+        return 0;
+    }
+
+    QuadtreeParameters params{};
+    std::vector<TracedFrame> frames;
+    auto tracePath = options["trace"].as<std::string>();
+    if (!ReadLeafTrace(tracePath, params, frames) || frames.empty()) {
+        std::cerr << "No frames in trace '" << tracePath << "'\n";
+        return 1;
+    }
+    if (options["mip-sprites"].as<bool>()) {
+        params.mipSprites = true;
+    }
+    if (options["field-sprites"].as<bool>()) {
+        params.fieldSprites = true;
+    }
+
+    auto sprites = loadSprites(options["anim"].as<std::string>(), options["anim-start"].as<int>());
+    if (!sprites) {
+        std::cerr << "No animation frames found, aborting...\n";
+        return 1;
+    }
+
+    // Matched leaves only need the matcher's sprites to render; its table is never looked up.
+    bool matched = std::any_of(frames.begin(), frames.end(), [](const TracedFrame &frame) {
+        return std::any_of(frame.leaves.begin(), frame.leaves.end(),
+                           [](const Quadtree::LeafData &leaf) { return leaf.sprite >= 0; });
+    });
+    SpriteMatcher::Ptr matcher;
+    if (matched) {
+        auto matchSprites = sprites;
+        if (options.count("match")) {
+            matchSprites = loadSprites(options["match"].as<std::string>(), options["match-start"].as<int>());
+        }
+        if (matchSprites) {
+            matcher = std::make_shared<SpriteMatcher>(std::move(matchSprites), 0);
+        }
+    }
+
+    // Out of range sprites and phases would index past the stores; fall back to the animation phase instead.
+    int variantCount = 0;
+    for (auto &frame : frames) {
+        variantCount = std::max(variantCount, frame.variant + 1);
+        frame.phase = frame.phase % sprites->FrameCount();
+        for (auto &leaf : frame.leaves) {
+            if (!matcher || leaf.sprite >= matcher->GetSprites().FrameCount()) {
+                leaf.sprite = -1;
+            }
+        }
+    }
+
+    // The checker only matters for analysis.
+    auto checker = CreateSubdivisionChecker(ColorParameters{0});
+    std::vector<Quadtree> trees;
+    for (int v = 0; v < variantCount; ++v) {
+        trees.emplace_back(sprites, params, checker, matcher);
+    }
+
+    std::vector<Image> targets;
+    std::size_t leafCount = 0;
+    double pixelCount = 0;
+    std::map<int, std::size_t> leafSizes;
+    for (const auto &frame : frames) {
+        targets.emplace_back(frame.width, frame.height, frame.channels);
+        leafCount += frame.leaves.size();
+        pixelCount += static_cast<double>(frame.width) * frame.height;
+        for (const auto &leaf : frame.leaves) {
+            ++leafSizes[std::max(leaf.bounds.w, leaf.bounds.h)];
+        }
+    }
+
+    std::cout << std::format("{} frames, {} leaves ({:.0f} per frame), {} sprites{}\n", frames.size(), leafCount,
+                             static_cast<double>(leafCount) / static_cast<double>(frames.size()),
+                             sprites->FrameCount(),
+                             params.fieldSprites ? ", field sprites" : params.mipSprites ? ", mip sprites" : "");
+    std::cout << "Leaves by longer side:";
+    std::size_t cumulative = 0;
+    for (int limit = 1; cumulative < leafCount; limit *= 2) {
+        std::size_t count = 0;
+        for (auto it = leafSizes.lower_bound(limit / 2 + 1); it != leafSizes.end() && it->first <= limit; ++it) {
+            count += it->second;
+        }
+        if (count > 0) {
+            std::cout << std::format(" <={}: {:.1f}%", limit, 100.0 * static_cast<double>(count) / leafCount);
+        }
+        cumulative += count;
+    }
+    std::cout << "\n";
+
+    double coldMs = renderAll(trees, frames, targets, nullptr);
+    std::cout << std::format("Cold pass: {:.1f} ms\n", coldMs);
+
+    int iterations = std::max(options["iterations"].as<int>(), 1);
+    std::vector<double> passes;
+    std::vector<double> frameTimes;
+    for (int i = 0; i < iterations; ++i) {
+        passes.push_back(renderAll(trees, frames, targets, &frameTimes));
+    }
+
+    std::sort(passes.begin(), passes.end());
+    std::sort(frameTimes.begin(), frameTimes.end());
+    auto percentile = [&](double p) {
+        return frameTimes[std::min(frameTimes.size() - 1, static_cast<std::size_t>(p * frameTimes.size()))];
+    };
+    double best = passes.front();
+    std::cout << std::format("Pass: best {:.1f} ms, median {:.1f} ms over {} passes\n", best,
+                             passes[passes.size() / 2], iterations);
+    std::cout << std::format("Frame: median {:.3f} ms, p90 {:.3f} ms, max {:.3f} ms\n", percentile(0.5),
+                             percentile(0.9), frameTimes.back());
+    std::cout << std::format("Best pass: {:.1f} ns/leaf, {:.2f} ns/pixel\n",
+                             best * 1e6 / static_cast<double>(leafCount), best * 1e6 / pixelCount);
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Times Quadtree::Analyze alone on frames sampled from the input under different split configurations, each given as
+// the cells per side at each depth separated by '/', optionally followed by @ and the top level cell size: "2" is the
+// plain quadtree, "4/2@128" cuts the frame into cells of at most 128 pixels, splits those 4x4 and the rest 2x2.
+// Leaf counts and the PSNR of the frame filled with each leaf's flat color show what each configuration changes.
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "Image.h"
+#include "ImageMetrics.h"
+#include "Quadtree.h"
+#include "lib/cxxopts.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+bool parseConfig(const std::string &config, QuadtreeParameters &params) {
+    params.splits.clear();
+    params.rootCell = 0;
+    try {
+        auto at = config.find('@');
+        if (at != std::string::npos) {
+            params.rootCell = std::stoi(config.substr(at + 1));
+        }
+        std::size_t pos = 0;
+        while (pos < std::min(at, config.size())) {
+            auto slash = std::min(config.find('/', pos), at);
+            params.splits.push_back(std::stoi(config.substr(pos, slash - pos)));
+            pos = slash == at ? at : slash + 1;
+        }
+    } catch (std::exception &) {
+        return false;
+    }
+    return std::all_of(params.splits.begin(), params.splits.end(),
+                       [](int split) { return split >= 2 && split <= maxSplit; }) &&
+           params.rootCell >= 0;
+}
+
+int main(int argc, char *argv[]) {
+    cxxopts::Options optParser("bench_traversal", "Times quadtree analysis under different split configurations.");
+    // clang-format off
+    optParser.add_options()
+        ("a,anim", "Path pattern to the animation frames", cxxopts::value<std::string>()->default_value("res/{}.png"))
+        ("anim-start", "First frame index of animation frames", cxxopts::value<int>()->default_value("0"))
+        ("i,input", "Path pattern to input frames", cxxopts::value<std::string>()->default_value("in/img_{}.png"))
+        ("input-start", "First frame index of input frames", cxxopts::value<int>()->default_value("1"))
+        ("n,samples", "Number of input frames to sample, spread evenly", cxxopts::value<int>()->default_value("8"))
+        ("m,mode", "Must be either 'bw' or 'color'", cxxopts::value<std::string>()->default_value("color"))
+        ("s,similarity", "Similarity threshold (0-255)", cxxopts::value<int>()->default_value("8"))
+        ("min-size", "Minimum leaf dimension", cxxopts::value<int>()->default_value("8"))
+        ("configs", "Split configurations to time, the first being the one the others are compared to", cxxopts::value<std::vector<std::string>>()->default_value("2,4/2,4,2@64,4/2@128"))
+        ("iterations", "Timed passes over the sampled frames per configuration; the median is reported", cxxopts::value<int>()->default_value("5"))
+        ("h,help", "Print usage");
+    // clang-format on
+
+    auto options = optParser.parse(argc, argv);
+    if (options.count("help")) {
+        std::cout << optParser.help() << std::endl;
+        return 0;
+    }
+
+    auto sprites = loadSprites(options["anim"].as<std::string>(), options["anim-start"].as<int>());
+    if (!sprites) {
+        std::cerr << "No animation frames found, aborting...\n";
+        return 1;
+    }
+
+    auto inputPaths = findFrames(options["input"].as<std::string>(), options["input-start"].as<int>());
+    if (inputPaths.empty()) {
+        std::cerr << "No input frames found, aborting...\n";
+        return 1;
+    }
+
+    // Statistics are shared by every configuration, as they are by variants; only the traversal is timed.
+    std::size_t sampleCount = std::min<std::size_t>(std::max(options["samples"].as<int>(), 1), inputPaths.size());
+    std::vector<Image> frames;
+    for (std::size_t i = 0; i < sampleCount; ++i) {
+        frames.emplace_back(inputPaths[i * inputPaths.size() / sampleCount].c_str(), ImageDecoder::Fast);
+    }
+    std::vector<std::unique_ptr<FrameStats>> stats;
+    for (const auto &frame : frames) {
+        stats.push_back(std::make_unique<FrameStats>(frame, false));
+    }
+
+    SubdivisionChecker::Ptr checker;
+    int similarity = options["similarity"].as<int>();
+    if (options["mode"].as<std::string>() == "bw") {
+        checker = CreateSubdivisionChecker(BWParameters{similarity});
+    } else {
+        checker = CreateSubdivisionChecker(ColorParameters{similarity});
+    }
+
+    // Leaves cover the whole frame, so the background never shows.
+    QuadtreeParameters params{};
+    params.minSize = std::max(options["min-size"].as<int>(), 1);
+    int iterations = std::max(options["iterations"].as<int>(), 1);
+
+    std::cout << std::format("{} of {} frames, {}x{}\n\n", frames.size(), inputPaths.size(), frames[0].width(),
+                             frames[0].height());
+    std::cout << std::format("{:<12}{:>14}{:>9}{:>10}{:>8}\n", "config", "ms per frame", "speedup", "leaves",
+                             "PSNR");
+    double baselineMs = 0;
+    for (const auto &config : options["configs"].as<std::vector<std::string>>()) {
+        if (!parseConfig(config, params)) {
+            std::cerr << "Ignoring malformed config: '" << config << "'\n";
+            continue;
+        }
+        Quadtree tree(sprites, params, checker);
+
+        std::vector<double> passMs;
+        std::vector<Quadtree::LeafList> leaves(frames.size());
+        for (int it = 0; it < iterations; ++it) {
+            auto start = Clock::now();
+            for (std::size_t i = 0; i < frames.size(); ++i) {
+                leaves[i] = tree.Analyze(*stats[i]);
+            }
+            passMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        std::sort(passMs.begin(), passMs.end());
+        double frameMs = passMs[passMs.size() / 2] / static_cast<double>(frames.size());
+        if (baselineMs == 0) {
+            baselineMs = frameMs;
+        }
+
+        double leafCount = 0;
+        double psnr = 0;
+        for (std::size_t i = 0; i < frames.size(); ++i) {
+            Image flat(frames[i].width(), frames[i].height(), frames[i].channels());
+            for (const auto &leaf : leaves[i]) {
+                flat.rect(leaf.bounds, leaf.color);
+            }
+            leafCount += static_cast<double>(leaves[i].size());
+            psnr += std::min(ComputePsnr(frames[i].view(), flat.view()), 99.0);
+        }
+        auto n = static_cast<double>(frames.size());
+        std::cout << std::format("{:<12}{:>14.3f}{:>8.2f}x{:>10.0f}{:>8.2f}\n", config, frameMs, baselineMs / frameMs,
+                                 leafCount / n, psnr / n);
+    }
+    return 0;
+}
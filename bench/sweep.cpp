@@ -0,0 +1,264 @@
+// Runs a grid of --mode, --similarity, --min-size, --denoise and --block-align settings over frames sampled from the
+// input and reports what each costs (analysis and render time, leaf count, PNG size and estimated intra coded size of
+// the rendered frame) against how well its leaves approximate the input: PSNR and SSIM of the frame filled with each
+// leaf's flat color. Settings no other
+// setting beats on both the chosen cost and quality are marked as the Pareto front. With --noise, settings analyze
+// the frames with grain added and are measured against the clean ones.
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "Image.h"
+#include "ImageMetrics.h"
+#include "Quadtree.h"
+#include "lib/cxxopts.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Quantizer step of the intra coded size estimate, the one H.264 uses at QP 28.
+constexpr int intraStep = 16;
+
+struct SweepFrame {
+    Image image;
+    Image luma;
+    // What settings analyze and render: the image, with grain if any.
+    Image input;
+};
+
+struct SweepResult {
+    std::string mode;
+    int similarity;
+    int minSize;
+    int denoise;
+    int blockAlign;
+    double analyzeMs = 0;
+    double renderMs = 0;
+    double leaves = 0;
+    double pngBytes = 0;
+    double intraBits = 0;
+    double psnr = 0;
+    double ssim = 0;
+    bool pareto = false;
+};
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void addGrain(Image &image, double sigma, std::mt19937 &rng) {
+    std::normal_distribution<double> grain(0, sigma);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            for (int c = 0; c < image.channels(); ++c) {
+                image(x, y, c) = static_cast<byte>(std::clamp(image(x, y, c) + std::lround(grain(rng)), 0L, 255L));
+            }
+        }
+    }
+}
+
+SweepResult runSetting(SpriteStore::Ptr sprites, const QuadtreeParameters &params, const std::string &mode,
+                       int similarity, int denoise, const std::vector<SweepFrame> &frames) {
+    SweepResult result{mode, similarity, params.minSize, denoise, params.blockAlign};
+    SubdivisionChecker::Ptr checker;
+    if (mode == "bw") {
+        checker = CreateSubdivisionChecker(BWParameters{similarity});
+    } else {
+        checker = CreateSubdivisionChecker(ColorParameters{similarity});
+    }
+    Quadtree tree(std::move(sprites), params, checker);
+
+    for (const auto &frame : frames) {
+        const Image &image = frame.image;
+        // Analysis time includes the statistics, as a prefilter adds to them.
+        auto start = Clock::now();
+        FrameStats stats(frame.input, false, denoise);
+        auto leaves = tree.Analyze(stats);
+        result.analyzeMs += elapsedMs(start);
+
+        // The first render of a leaf size resizes sprites for it; only time the second, as a long job would see it.
+        Image rendered(image.width(), image.height(), image.channels());
+        tree.Render(leaves, rendered, 0);
+        start = Clock::now();
+        tree.Render(leaves, rendered, 0);
+        result.renderMs += elapsedMs(start);
+
+        result.leaves += static_cast<double>(leaves.size());
+        result.pngBytes += static_cast<double>(rendered.pngSize());
+        result.intraBits += EstimateIntraBits(rendered.lumaNew().view(), intraStep);
+
+        Image flat(image.width(), image.height(), image.channels());
+        flat.fill(params.background);
+        for (const auto &leaf : leaves) {
+            flat.rect(leaf.bounds, leaf.color);
+        }
+        result.psnr += std::min(ComputePsnr(image.view(), flat.view()), 99.0);
+        result.ssim += ComputeSsim(frame.luma.view(), flat.lumaNew().view());
+    }
+
+    auto n = static_cast<double>(frames.size());
+    result.analyzeMs /= n;
+    result.renderMs /= n;
+    result.leaves /= n;
+    result.pngBytes /= n;
+    result.intraBits /= n;
+    result.psnr /= n;
+    result.ssim /= n;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    cxxopts::Options optParser("sweep", "Measures cost and quality of a grid of settings on sampled input frames.");
+    // clang-format off
+    optParser.add_options()
+        ("a,anim", "Path pattern to the animation frames", cxxopts::value<std::string>()->default_value("res/{}.png"))
+        ("anim-start", "First frame index of animation frames", cxxopts::value<int>()->default_value("0"))
+        ("i,input", "Path pattern to input frames", cxxopts::value<std::string>()->default_value("in/img_{}.png"))
+        ("input-start", "First frame index of input frames", cxxopts::value<int>()->default_value("1"))
+        ("n,samples", "Number of input frames to sample, spread evenly", cxxopts::value<int>()->default_value("8"))
+        ("modes", "Modes to try", cxxopts::value<std::vector<std::string>>()->default_value("color"))
+        ("similarities", "Similarity thresholds to try", cxxopts::value<std::vector<int>>()->default_value("4,8,12,16,24,32"))
+        ("min-sizes", "Minimum leaf dimensions to try", cxxopts::value<std::vector<int>>()->default_value("4,8,16"))
+        ("denoise", "Prefilter radii to try, 0 being none", cxxopts::value<std::vector<int>>()->default_value("0"))
+        ("noise", "Standard deviation of the gaussian grain added to the sampled frames", cxxopts::value<double>()->default_value("0"))
+        ("block-aligns", "Block alignments to try, 0 being none", cxxopts::value<std::vector<int>>()->default_value("0"))
+        ("cost", "Cost for the Pareto front: 'time' (analysis + render), 'leaves', 'size' (PNG) or 'encode' (estimated intra coded size)", cxxopts::value<std::string>()->default_value("time"))
+        ("quality", "Quality for the Pareto front: 'ssim' or 'psnr'", cxxopts::value<std::string>()->default_value("ssim"))
+        ("target", "Report the cheapest setting reaching this quality", cxxopts::value<double>())
+        ("csv", "Also write every result to this CSV file", cxxopts::value<std::string>())
+        ("h,help", "Print usage");
+    // clang-format on
+
+    auto options = optParser.parse(argc, argv);
+    if (options.count("help")) {
+        std::cout << optParser.help() << std::endl;
+        return 0;
+    }
+
+    auto costName = options["cost"].as<std::string>();
+    auto qualityName = options["quality"].as<std::string>();
+    if ((costName != "time" && costName != "leaves" && costName != "size" && costName != "encode") ||
+        (qualityName != "ssim" && qualityName != "psnr")) {
+        std::cout << optParser.help() << std::endl;
+        return 0;
+    }
+
+    auto sprites = loadSprites(options["anim"].as<std::string>(), options["anim-start"].as<int>());
+    if (!sprites) {
+        std::cerr << "No animation frames found, aborting...\n";
+        return 1;
+    }
+
+    auto inputPaths = findFrames(options["input"].as<std::string>(), options["input-start"].as<int>());
+    if (inputPaths.empty()) {
+        std::cerr << "No input frames found, aborting...\n";
+        return 1;
+    }
+
+    std::size_t sampleCount = std::min<std::size_t>(std::max(options["samples"].as<int>(), 1), inputPaths.size());
+    std::vector<SweepFrame> frames;
+    std::mt19937 rng(1);
+    for (std::size_t i = 0; i < sampleCount; ++i) {
+        Image image(inputPaths[i * inputPaths.size() / sampleCount].c_str(), ImageDecoder::Fast);
+        auto luma = image.lumaNew();
+        Image input = image;
+        if (options["noise"].as<double>() > 0) {
+            addGrain(input, options["noise"].as<double>(), rng);
+        }
+        frames.push_back({std::move(image), std::move(luma), std::move(input)});
+    }
+
+    // Leaves cover the whole frame, so the background never shows.
+    QuadtreeParameters params{};
+
+    std::vector<SweepResult> results;
+    for (const auto &mode : options["modes"].as<std::vector<std::string>>()) {
+        if (mode != "bw" && mode != "color") {
+            std::cerr << "Ignoring unknown mode: '" << mode << "'\n";
+            continue;
+        }
+        for (int minSize : options["min-sizes"].as<std::vector<int>>()) {
+            params.minSize = std::max(minSize, 1);
+            for (int similarity : options["similarities"].as<std::vector<int>>()) {
+                for (int denoise : options["denoise"].as<std::vector<int>>()) {
+                    for (int align : options["block-aligns"].as<std::vector<int>>()) {
+                        params.blockAlign = std::max(align, 0);
+                        results.push_back(runSetting(sprites, params, mode, similarity, std::max(denoise, 0), frames));
+                        std::cerr << '.';
+                    }
+                }
+            }
+        }
+    }
+    std::cerr << '\n';
+
+    auto cost = [&](const SweepResult &r) {
+        if (costName == "leaves") {
+            return r.leaves;
+        }
+        if (costName == "size") {
+            return r.pngBytes;
+        }
+        if (costName == "encode") {
+            return r.intraBits;
+        }
+        return r.analyzeMs + r.renderMs;
+    };
+    auto quality = [&](const SweepResult &r) { return qualityName == "psnr" ? r.psnr : r.ssim; };
+
+    // Cheapest first; a setting is on the front if it beats every cheaper one on quality.
+    std::stable_sort(results.begin(), results.end(),
+                     [&](const SweepResult &a, const SweepResult &b) { return cost(a) < cost(b); });
+    double bestQuality = -std::numeric_limits<double>::infinity();
+    for (auto &r : results) {
+        if (quality(r) > bestQuality) {
+            r.pareto = true;
+            bestQuality = quality(r);
+        }
+    }
+
+    std::cout << std::format("{} of {} frames, cost: {}, quality: {}\n\n", frames.size(), inputPaths.size(), costName,
+                             qualityName);
+    std::cout << std::format("  {:<6}{:>5}{:>5}{:>9}{:>7}{:>11}{:>11}{:>9}{:>10}{:>10}{:>8}{:>8}\n", "mode", "sim",
+                             "min", "denoise", "align", "analyze ms", "render ms", "leaves", "png KB", "intra KB",
+                             "PSNR", "SSIM");
+    for (const auto &r : results) {
+        std::cout << std::format(
+            "{} {:<6}{:>5}{:>5}{:>9}{:>7}{:>11.2f}{:>11.2f}{:>9.0f}{:>10.1f}{:>10.1f}{:>8.2f}{:>8.4f}\n",
+            r.pareto ? '*' : ' ', r.mode, r.similarity, r.minSize, r.denoise, r.blockAlign, r.analyzeMs, r.renderMs,
+            r.leaves, r.pngBytes / 1024, r.intraBits / 8192, r.psnr, r.ssim);
+    }
+    std::cout << "\n* Pareto front: nothing cheaper is as good.\n";
+
+    if (options.count("target")) {
+        double target = options["target"].as<double>();
+        auto it = std::find_if(results.begin(), results.end(),
+                               [&](const SweepResult &r) { return quality(r) >= target; });
+        if (it != results.end()) {
+            std::cout << std::format(
+                "Cheapest reaching {} {}: -m {} -s {} --min-size {} --denoise {} --block-align {}\n", qualityName,
+                target, it->mode, it->similarity, it->minSize, it->denoise, it->blockAlign);
+        } else {
+            std::cout << std::format("Nothing reaches {} {}.\n", qualityName, target);
+        }
+    }
+
+    if (options.count("csv")) {
+        std::ofstream csv(options["csv"].as<std::string>());
+        csv << "mode,similarity,min_size,denoise,block_align,analyze_ms,render_ms,leaves,png_bytes,intra_bits,psnr,"
+               "ssim,pareto\n";
+        for (const auto &r : results) {
+            csv << std::format("{},{},{},{},{},{:.3f},{:.3f},{:.1f},{:.0f},{:.0f},{:.3f},{:.5f},{}\n", r.mode,
+                               r.similarity, r.minSize, r.denoise, r.blockAlign, r.analyzeMs, r.renderMs, r.leaves,
+                               r.pngBytes, r.intraBits, r.psnr, r.ssim, r.pareto ? 1 : 0);
+        }
+    }
+    return 0;
+}
@@ -1,18 +1,31 @@
 #include <condition_variable>
 #include <filesystem>
 #include <format>
+#include <fstream>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "Dispatch.h"
+#include "Heatmaps.h"
 #include "Image.h"
+#include "LeafTrace.h"
+#include "PngEncoder.h"
 #include "Quadtree.h"
+#include "SceneCuts.h"
+#include "ScopeTrace.h"
+#include "Y4mWriter.h"
 #include "lib/cxxopts.hpp"
 #include "lib/thread_pool.hpp"
 
 namespace fs = std::filesystem;
 
+SubdivisionChecker::Ptr createChecker(std::string mode, int similarity);
 void createVideoFrames(const cxxopts::ParseResult &options, SubdivisionChecker::Ptr checker);
 
 int main(int argc, char *argv[]) {
@@ -29,9 +42,34 @@ int main(int argc, char *argv[]) {
         ("b,background", "Background color", cxxopts::value<std::string>()->default_value("#000000"))
         ("p,out-resolution", "Output vertical resolution", cxxopts::value<int>()->implicit_value("480"))
         ("t,threads", "Number of threads to use", cxxopts::value<int>()->default_value(defaultThreads))
+        ("png-threads", "Threads on top of --threads that deflate PNGs while their frames are still being drawn (default: as many as --threads leaves cores idle)", cxxopts::value<int>())
         ("min-size", "Minimum leaf dimension", cxxopts::value<int>()->default_value("8"))
+        ("min-output-size", "When -p scales frames down, also keep leaves at least this many output pixels across, as smaller sprites aren't legible", cxxopts::value<int>()->default_value("4"))
+        ("splits", "Cells per side a node splits into at each depth, from the top level cells down (e.g. 4,2 for 4x4 then 2x2); deeper levels split 2x2", cxxopts::value<std::vector<int>>())
+        ("denoise", "Subdivide on the input box filtered with this radius, so grain doesn't split leaves; colors stay unfiltered", cxxopts::value<int>()->implicit_value("2"))
+        ("block-align", "Snap leaf edges to a grid of blocks this size (e.g. 16) so they don't cut through a video encoder's blocks", cxxopts::value<int>()->default_value("0"))
+        ("root-cell", "Cut the top level strips into cells no larger than this, to skip the levels above that size on large frames", cxxopts::value<int>()->default_value("0"))
         ("anim-start", "First frame index of animation frames", cxxopts::value<int>()->default_value("0"))
         ("input-start", "First frame index of input frames", cxxopts::value<int>()->default_value("1"))
+        ("shared-sprites", "Name of a shared memory segment to share preprocessed sprites with other processes", cxxopts::value<std::string>())
+        ("scene-cuts", "Process consecutive frames in order, reusing the previous frame's leaves where the pixels didn't change, but not across scene cuts found with this histogram distance threshold (0-2), which aren't interpolated across either", cxxopts::value<double>()->implicit_value("0.75"))
+        ("max-chunk", "Most consecutive frames one thread processes in order with --scene-cuts, and so the longest chunk between cuts; fewer if that would leave a thread without any", cxxopts::value<int>()->default_value("48"))
+        ("dispatch-window", "Frames, or --scene-cuts slices, that may start ahead of an earlier one predicted to take less time (0 for twice the thread count, 1 for index order)", cxxopts::value<int>()->default_value("0"))
+        ("interpolate", "Output frames per input frame; the extra ones are interpolated from neighbouring leaves", cxxopts::value<int>()->default_value("1"))
+        ("phase-offsets", "Offset each leaf's animation phase so leaves animate independently")
+        ("mip-sprites", "Scale sprites on the fly from a mip chain instead of caching every leaf size, to save memory")
+        ("field-sprites", "Render sprites from a small distance field of their silhouette: antialiased at any size, with no resized copies")
+        ("decoder", "PNG and JPEG decoder for input frames: 'stb', 'fast', or 'verify' to check fast against stb", cxxopts::value<std::string>()->default_value("fast"))
+        ("fps", "Frame rate recorded in .y4m output", cxxopts::value<int>()->default_value("30"))
+        ("preview", "Before the full pass, render every Nth frame at a quarter of the size so the look shows up early", cxxopts::value<int>()->implicit_value("8"))
+        ("preview-output", "Path pattern to --preview frames", cxxopts::value<std::string>()->default_value("preview/img_{}.png"))
+        ("heatmaps", "Also write each frame's leaf depth and its render time per tile of this size next to it, as .depth.png and .cost.png", cxxopts::value<int>()->implicit_value("32"))
+        ("record-trace", "Record the leaves of every rendered frame to this file, for bench_render to replay", cxxopts::value<std::string>())
+        ("trace-scopes", "Record the timing scopes of a build with AMOGUIFIER_TRACE_SCOPES to this file: .json for chrome://tracing, .bin, or else text", cxxopts::value<std::string>())
+        ("variants", "Extra renders from the same decode, each as mode:similarity=output pattern (e.g. bw:12=out_bw/img_{}.png)", cxxopts::value<std::vector<std::string>>())
+        ("match", "Pick each leaf's sprite by content from the frames matching this pattern (defaults to --anim)", cxxopts::value<std::string>()->implicit_value(""))
+        ("match-start", "First frame index of --match frames", cxxopts::value<int>()->default_value("0"))
+        ("match-contrast", "Minimum luminance contrast inside a leaf for --match to apply", cxxopts::value<int>()->default_value("16"))
         ("h,help", "Print usage");
     // clang-format on
 
@@ -43,29 +81,51 @@ int main(int argc, char *argv[]) {
     }
 
     auto mode = options["mode"].as<std::string>();
-    std::transform(mode.begin(), mode.end(), mode.begin(), [](char c) { return (char)std::tolower(c); });
-    SubdivisionChecker::Ptr checker;
-    if (mode == "bw") {
-        BWParameters params{options["similarity"].as<int>()};
-        checker = CreateSubdivisionChecker(params);
-    } else if (mode == "color") {
-        ColorParameters params{options["similarity"].as<int>()};
-        checker = CreateSubdivisionChecker(params);
-    } else {
+    auto checker = createChecker(mode, options["similarity"].as<int>());
+    if (!checker) {
         std::cerr << "Unknown mode: '" << mode << "'\n";
         std::cout << optParser.help() << std::endl;
         return 0;
     }
 
+    if (options.count("trace-scopes")) {
+        if (ScopeTraceCompiled()) {
+            EnableScopeTrace();
+        } else {
+            std::cerr << "Timing scopes aren't compiled in; build with AMOGUIFIER_TRACE_SCOPES for --trace-scopes.\n";
+        }
+    }
+
     try {
         createVideoFrames(options, std::move(checker));
     } catch (std::exception &e) {
         std::cerr << e.what() << std::endl;
     }
 
+    // The thread pool is gone by now, so every scope has been recorded.
+    if (options.count("trace-scopes") && ScopeTraceCompiled()) {
+        auto tracePath = options["trace-scopes"].as<std::string>();
+        if (!FlushScopeTrace(tracePath)) {
+            std::cerr << "Couldn't write timing scopes to " << tracePath << "\n";
+        }
+    }
+
     return 0;
 }
 
+SubdivisionChecker::Ptr createChecker(std::string mode, int similarity) {
+    std::transform(mode.begin(), mode.end(), mode.begin(), [](char c) { return (char)std::tolower(c); });
+    if (mode == "bw") {
+        BWParameters params{similarity};
+        return CreateSubdivisionChecker(params);
+    }
+    if (mode == "color") {
+        ColorParameters params{similarity};
+        return CreateSubdivisionChecker(params);
+    }
+    return nullptr;
+}
+
 int parseHexDigit(char digit) {
     char d = static_cast<char>(std::tolower(digit));
     if ('a' <= d && d <= 'f') {
@@ -144,154 +204,754 @@ class ProgressBar {
     int mSize;
 };
 
-class QuadtreeBuilder {
-  public:
-    QuadtreeBuilder(fs::path path, QuadtreeParameters params, SubdivisionChecker::Ptr checker)
-        : mPath(std::move(path)), mParams(params), mChecker(std::move(checker)) {}
+std::vector<fs::path> findFrames(const std::string &pattern, int start) {
+    std::vector<fs::path> paths;
+    for (int frame = start;; ++frame) {
+        fs::path path = fs::absolute(fs::path(std::format(pattern, frame)));
+        if ((!paths.empty() && path == paths.back()) || !fs::exists(path)) {
+            break;
+        }
+        paths.push_back(std::move(path));
+    }
+    return paths;
+}
 
-    void AddUse() {
-        std::unique_lock lock(*mMutexPtr);
-        ++mUseCount;
-        ReleaseImpl();
+SpriteStore::Ptr loadSprites(const std::vector<fs::path> &paths) {
+    std::vector<std::string> names;
+    for (const auto &path : paths) {
+        names.push_back(path.string());
     }
+    return SpriteStore::Load(names);
+}
 
-    Quadtree &GetTree() {
-        std::unique_lock lock(*mMutexPtr);
-        if (!mQuadtree) {
-            mQuadtree = Quadtree{Image{mPath.string().c_str()}.rescaleLuminance(), mParams, mChecker};
-            mUses = 0;
+// Identifies a set of sprite files without decoding them, so processes can tell whether a shared store matches theirs.
+uint64_t fingerprintFrames(const std::vector<fs::path> &paths) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](const void *data, std::size_t size) {
+        for (std::size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<const byte *>(data)[i]) * 0x100000001b3ull;
         }
-        return *mQuadtree;
+    };
+    for (const auto &path : paths) {
+        auto name = path.string();
+        auto size = static_cast<uint64_t>(fs::file_size(path));
+        auto time = static_cast<int64_t>(fs::last_write_time(path).time_since_epoch().count());
+        mix(name.data(), name.size());
+        mix(&size, sizeof(size));
+        mix(&time, sizeof(time));
+    }
+    return hash;
+}
+
+SpriteMatcher::Ptr createSpriteMatcher(const cxxopts::ParseResult &options, SpriteStore::Ptr animSprites) {
+    if (!options.count("match")) {
+        return nullptr;
     }
 
-    void Release() {
-        std::unique_lock lock(*mMutexPtr);
-        ++mUses;
-        ReleaseImpl();
+    // Matching against the animation frames shares their resized leaves instead of building a second set.
+    auto sprites = std::move(animSprites);
+    if (auto matchPat = options["match"].as<std::string>(); !matchPat.empty()) {
+        sprites = loadSprites(findFrames(matchPat, options["match-start"].as<int>()));
+    }
+    if (!sprites) {
+        std::cerr << "No sprites found for --match, matching disabled.\n";
+        return nullptr;
     }
 
-    void AllowRelease() {
-        std::unique_lock lock(*mMutexPtr);
-        mAllowRelease = true;
-        ReleaseImpl();
+    std::cout << "Matching leaves against " << sprites->FrameCount() << " sprites.\n";
+    return std::make_shared<SpriteMatcher>(std::move(sprites), options["match-contrast"].as<int>());
+}
+
+struct FrameOutput {
+    // One path per variant, in the same order as the trees rendering them.
+    std::vector<fs::path> paths;
+    int index;
+    int phase;
+};
+
+struct FrameJob {
+    fs::path inPath;
+    FrameOutput out;
+    // Frames synthesized between this frame and the next one with --interpolate.
+    std::vector<FrameOutput> between;
+    // Pixels of the input frame, which its cost is predicted from.
+    double pixels = 0;
+};
+
+struct AnalyzedFrame {
+    // Leaves of every variant.
+    std::vector<Quadtree::LeafList> leaves;
+    int width;
+    int height;
+    int channels;
+};
+
+// How frames are read and written.
+struct FrameIO {
+    ImageDecoder decoder = ImageDecoder::Stb;
+    DecodeHints hints;
+    std::optional<int> outRes;
+    int fps = 30;
+    // Single y4m files every frame of a variant goes to, by path.
+    std::map<fs::path, std::unique_ptr<Y4mWriter>> streams;
+    std::unique_ptr<LeafTraceWriter> trace;
+    // Tile size of the render time heatmaps written with --heatmaps.
+    std::optional<int> heatmapTile;
+    // Box filter radius subdivision sees the input through, with --denoise.
+    int denoise = 0;
+};
+
+// Size a frame is saved at with -p: outRes high, rounded up to even dimensions for 4:2:0 output.
+std::pair<int, int> outputSize(const Image &frame, int outRes) {
+    int h = outRes;
+    if (h % 2) {
+        ++h;
+    }
+    int w = frame.width() * h / frame.height();
+    if (w % 2) {
+        ++w;
     }
+    return {w, h};
+}
 
-  private:
-    void ReleaseImpl() {
-        if (mAllowRelease && mUses >= mUseCount) {
-            mQuadtree = std::nullopt;
+// Output is PNG, except for .yuv (raw I420 planes) and .y4m paths. A .y4m path shared by every frame is one stream.
+void saveFrame(Image frame, const fs::path &outPath, int index, const FrameIO &io) {
+    TRACE_SCOPE("saveFrame");
+    if (outPath.has_parent_path()) {
+        fs::create_directories(outPath.parent_path());
+    }
+
+    if (io.outRes) {
+        auto [w, h] = outputSize(frame, *io.outRes);
+        frame = frame.resizeFastNew(w, h);
+    }
+
+    if (auto it = io.streams.find(outPath); it != io.streams.end()) {
+        it->second->Write(index, frame.width(), frame.height(), frame.yuv420New());
+    } else if (outPath.extension() == ".y4m") {
+        Y4mWriter(outPath.string(), index, io.fps).Write(index, frame.width(), frame.height(), frame.yuv420New());
+    } else if (outPath.extension() == ".yuv") {
+        auto planes = frame.yuv420New();
+        std::ofstream(outPath, std::ios::binary)
+            .write(reinterpret_cast<const char *>(planes.data()), static_cast<std::streamsize>(planes.size()));
+    } else {
+        frame.save(outPath.string().c_str());
+    }
+}
+
+// A frame that won't be saved after all, so the streams it was going to are written on without it.
+void skipFrame(const FrameOutput &out, const FrameIO &io) {
+    for (const auto &path : out.paths) {
+        if (auto it = io.streams.find(path); it != io.streams.end()) {
+            it->second->Skip(out.index);
         }
     }
+}
 
-    std::unique_ptr<std::mutex> mMutexPtr = std::make_unique<std::mutex>();
-    std::optional<Quadtree> mQuadtree;
-    fs::path mPath;
-    QuadtreeParameters mParams;
-    SubdivisionChecker::Ptr mChecker;
+// Whether saveFrame writes outPath as a PNG.
+bool savesPng(const fs::path &outPath, const FrameIO &io) {
+    return !io.streams.count(outPath) && outPath.extension() != ".y4m" && outPath.extension() != ".yuv";
+}
 
-    int mUseCount = 0;
-    int mUses = 0;
-    bool mAllowRelease = false;
-};
+// Rows rendered between hand-offs to the PNG encoder.
+constexpr int pngBandRows = 32;
+
+// Renders a frame and writes it as saveFrame writes PNGs, scaled to outRes if given. Each band of rows is scaled and
+// handed to the encoder as soon as it's drawn, so with a --png-threads thread free deflating the frame overlaps
+// rendering it instead of following it.
+void renderToPng(Quadtree &tree, const Quadtree::LeafList &leaves, Image &frame, int phase, const fs::path &outPath,
+                 std::optional<int> outRes) {
+    TRACE_SCOPE("renderToPng");
+    if (outPath.has_parent_path()) {
+        fs::create_directories(outPath.parent_path());
+    }
+
+    std::optional<Image> scaled;
+    if (outRes) {
+        auto [w, h] = outputSize(frame, *outRes);
+        scaled.emplace(w, h, frame.channels());
+    }
+    PngStreamEncoder encoder(scaled ? *scaled : frame);
+    int scaledRows = 0;
+    tree.Render(leaves, frame, phase, pngBandRows, [&](int rows) {
+        if (scaled) {
+            scaledRows = frame.resizeFastRows(*scaled, scaledRows, rows);
+            encoder.RowsDone(scaledRows);
+        } else {
+            encoder.RowsDone(rows);
+        }
+    });
+    encoder.Finish(outPath.string().c_str());
+}
+
+// A color frame decoded to red alone still renders in color.
+int renderChannels(const Image &frame, const FrameIO &io) {
+    return io.hints.redOnly && frame.channels() == 1 ? 3 : frame.channels();
+}
+
+// Debug images go next to the frame they belong to; the frames of a stream are told apart by their index.
+fs::path heatmapPath(const fs::path &outPath, int index, const FrameIO &io, const std::string &kind) {
+    auto stem = outPath.stem().string();
+    if (io.streams.count(outPath)) {
+        stem += "_" + std::to_string(index);
+    }
+    return outPath.parent_path() / (stem + "." + kind + ".png");
+}
+
+// Records the leaves every variant of a frame is rendered from, with --record-trace.
+void traceFrame(const AnalyzedFrame &analyzed, const FrameOutput &out, const FrameIO &io) {
+    if (!io.trace) {
+        return;
+    }
+    for (std::size_t v = 0; v < analyzed.leaves.size(); ++v) {
+        io.trace->Write({out.index, out.phase, static_cast<int>(v), analyzed.width, analyzed.height, analyzed.channels,
+                         analyzed.leaves[v]});
+    }
+}
+
+void renderAndSave(std::vector<Quadtree> &trees, const AnalyzedFrame &analyzed, const FrameOutput &out,
+                   const FrameIO &io) {
+    for (std::size_t v = 0; v < trees.size(); ++v) {
+        Image frame(analyzed.width, analyzed.height, analyzed.channels);
+        bool saved = false;
+        if (io.heatmapTile) {
+            std::vector<float> leafNs;
+            trees[v].Render(analyzed.leaves[v], frame, out.phase, leafNs);
+            if (out.paths[v].has_parent_path()) {
+                fs::create_directories(out.paths[v].parent_path());
+            }
+            DepthHeatmapNew(analyzed.leaves[v], analyzed.width, analyzed.height)
+                .save(heatmapPath(out.paths[v], out.index, io, "depth").string().c_str());
+            CostHeatmapNew(analyzed.leaves[v], leafNs, analyzed.width, analyzed.height, *io.heatmapTile)
+                .save(heatmapPath(out.paths[v], out.index, io, "cost").string().c_str());
+        } else if (savesPng(out.paths[v], io)) {
+            renderToPng(trees[v], analyzed.leaves[v], frame, out.phase, out.paths[v], io.outRes);
+            saved = true;
+        } else {
+            trees[v].Render(analyzed.leaves[v], frame, out.phase);
+        }
+        if (!saved) {
+            saveFrame(std::move(frame), out.paths[v], out.index, io);
+        }
+    }
+    traceFrame(analyzed, out, io);
+}
+
+// Statistics of the frame for every variant.
+FrameStats frameStats(std::vector<Quadtree> &trees, const Image &frame, const FrameIO &io) {
+    bool needsLuma = std::any_of(trees.begin(), trees.end(), [](const Quadtree &tree) { return tree.NeedsLuma(); });
+    return FrameStats(frame, needsLuma, io.denoise);
+}
+
+// The statistics are built once for all variants; each variant only subdivides. Given the previous frame, which stats
+// were compared with, each variant takes over its leaves where nothing changed.
+AnalyzedFrame analyzeFrame(std::vector<Quadtree> &trees, const FrameStats &stats, const FrameIO &io,
+                           const AnalyzedFrame *prev = nullptr) {
+    const Image &frame = stats.frame;
+    AnalyzedFrame analyzed{{}, frame.width(), frame.height(), renderChannels(frame, io)};
+    for (std::size_t v = 0; v < trees.size(); ++v) {
+        analyzed.leaves.push_back(prev ? trees[v].Analyze(stats, prev->leaves[v]) : trees[v].Analyze(stats));
+    }
+    return analyzed;
+}
+
+// Decodes the frame, analyzes it for every variant and renders them.
+AnalyzedFrame analyzeAndSave(std::vector<Quadtree> &trees, const FrameJob &job, const FrameIO &io) {
+    AnalyzedFrame analyzed;
+    {
+        // The input is only needed for analysis; rendering goes to separate output buffers.
+        Image frame(job.inPath.string().c_str(), io.decoder, io.hints);
+        analyzed = analyzeFrame(trees, frameStats(trees, frame, io), io);
+    }
+
+    renderAndSave(trees, analyzed, job.out, io);
+    return analyzed;
+}
+
+// A quick look at a frame: analyzed and rendered at a quarter of the size. The preview tree scales its sprites from
+// mips, so the preview's leaf sizes don't fill the sprite caches the full pass uses.
+void renderPreview(Quadtree &tree, const FrameJob &job, const fs::path &outPath, const FrameIO &io) {
+    int w, h, c;
+    if (!Image::info(job.inPath.string().c_str(), w, h, c)) {
+        throw std::runtime_error("unreadable frame");
+    }
+    auto hints = io.hints;
+    hints.scale = 4;
+    Image frame(job.inPath.string().c_str(), io.decoder, hints);
+    // Only JPEGs come back scaled.
+    while (frame.width() > (w + 3) / 4) {
+        frame = frame.halveNew();
+    }
+    Image rendered(frame.width(), frame.height(), renderChannels(frame, io));
+    renderToPng(tree, tree.Analyze(frame), rendered, job.out.phase, outPath, std::nullopt);
+}
+
+// Renders the frames between two analyzed frames from their interpolated leaves, with no decoding or subdivision.
+// Without a following frame the leaves are held; without a preceding one there is nothing to render.
+void renderBetween(std::vector<Quadtree> &trees, const FrameJob &job, const AnalyzedFrame *from,
+                   const AnalyzedFrame *to, const FrameIO &io, const std::function<void()> &frameDone) {
+    for (std::size_t i = 0; i < job.between.size(); ++i) {
+        const auto &out = job.between[i];
+        try {
+            if (from) {
+                float t = static_cast<float>(i + 1) / static_cast<float>(job.between.size() + 1);
+                if (to && to->width == from->width && to->height == from->height) {
+                    AnalyzedFrame blended{{}, from->width, from->height, from->channels};
+                    for (std::size_t v = 0; v < trees.size(); ++v) {
+                        blended.leaves.push_back(
+                            trees[v].Interpolate(from->leaves[v], to->leaves[v], from->width, from->height, t));
+                    }
+                    renderAndSave(trees, blended, out, io);
+                } else {
+                    renderAndSave(trees, *from, out, io);
+                }
+            } else {
+                skipFrame(out, io);
+            }
+        } catch (std::exception &e) {
+            std::cerr << "Interpolating " << out.paths[0] << " threw an exception: " << e.what() << "\n";
+            skipFrame(out, io);
+        }
+        frameDone();
+    }
+}
+
+// Processes a slice of consecutive frames in order, as chunks that end at scene cuts, where the signatures of
+// neighbouring frames are further apart than cutThreshold. Within a chunk a frame takes over the previous frame's
+// leaves wherever its pixels didn't change, or, with the same pixels throughout, its whole output when the animation
+// phase matches as well; the frames in between are interpolated. Nothing is reused or interpolated across a cut. The
+// frames between slices are left to edgeDone, which gets the first and last frame of the slice.
+void processSlice(std::vector<Quadtree> &trees, const std::vector<FrameJob> &jobs, std::size_t first, std::size_t last,
+                  double cutThreshold, const FrameIO &io, const std::function<void()> &frameDone,
+                  const std::function<void(std::size_t, std::optional<AnalyzedFrame>, const FrameSignature &)>
+                      &edgeDone) {
+    std::optional<AnalyzedFrame> prev;
+    // Input pixels and signature of the previous frame, if it was processed.
+    std::optional<Image> prevInput;
+    FrameSignature prevSignature{};
+
+    for (std::size_t i = first; i < last; ++i) {
+        const auto &job = jobs[i];
+        std::optional<AnalyzedFrame> current;
+        std::optional<Image> input;
+        FrameSignature signature{};
+        bool cut = false;
+        try {
+            input.emplace(job.inPath.string().c_str(), io.decoder, io.hints);
+            if (prev && prevInput && input->samePixels(*prevInput)) {
+                current = prev;
+                signature = prevSignature;
+                // Files can be copied, but a stream needs the frame written again, and heatmaps time the rendering.
+                bool copy = job.out.phase == jobs[i - 1].out.phase && !io.heatmapTile &&
+                            std::none_of(job.out.paths.begin(), job.out.paths.end(),
+                                         [&](const fs::path &path) { return io.streams.count(path) > 0; });
+                if (copy) {
+                    for (std::size_t v = 0; v < job.out.paths.size(); ++v) {
+                        const auto &path = job.out.paths[v];
+                        if (path.has_parent_path()) {
+                            fs::create_directories(path.parent_path());
+                        }
+                        fs::copy_file(jobs[i - 1].out.paths[v], path, fs::copy_options::overwrite_existing);
+                    }
+                    traceFrame(*current, job.out, io);
+                } else {
+                    renderAndSave(trees, *current, job.out, io);
+                }
+            } else {
+                auto stats = frameStats(trees, *input, io);
+                signature = ComputeFrameSignature(stats.sums);
+                cut = prev && prevInput && SignatureDistance(prevSignature, signature) > cutThreshold;
+                bool reuse = prev && prevInput && !cut;
+                if (reuse) {
+                    stats.CompareWith(*prevInput);
+                }
+                current = analyzeFrame(trees, stats, io, reuse ? &*prev : nullptr);
+                renderAndSave(trees, *current, job.out, io);
+            }
+        } catch (std::exception &e) {
+            std::cerr << "Process for " << job.inPath << " threw an exception: " << e.what() << "\n";
+            skipFrame(job.out, io);
+            current = std::nullopt;
+            input = std::nullopt;
+        }
+        frameDone();
+
+        if (i > first) {
+            renderBetween(trees, jobs[i - 1], prev ? &*prev : nullptr, current && !cut ? &*current : nullptr, io,
+                          frameDone);
+        }
+        if (i + 1 == last) {
+            edgeDone(i, std::move(current), signature);
+            break;
+        }
+        if (i == first) {
+            edgeDone(i, current, signature);
+        }
+        prev = std::move(current);
+        prevInput = std::move(input);
+        prevSignature = signature;
+    }
+}
 
 void createVideoFrames(const cxxopts::ParseResult &options, SubdivisionChecker::Ptr checker) {
     auto animPat = options["anim"].as<std::string>();
     auto inputPat = options["input"].as<std::string>();
-    auto outputPat = options["output"].as<std::string>();
+    std::vector<std::string> outputPats{options["output"].as<std::string>()};
     fs::path lastPath;
 
-    std::vector<QuadtreeBuilder> frameBuilders;
-
     std::cout << "Searching for animation frames...\n";
-    for (int frame = options["anim-start"].as<int>();; ++frame) {
-        fs::path path = fs::absolute(fs::path(std::format(animPat, frame)));
-        if (path == lastPath || !fs::exists(path)) {
-            break;
+    auto animPaths = findFrames(animPat, options["anim-start"].as<int>());
+
+    std::string sharedName = options.count("shared-sprites") ? options["shared-sprites"].as<std::string>() : "";
+    uint64_t fingerprint = fingerprintFrames(animPaths);
+    SpriteStore::Ptr sprites;
+    // Claimed before loading, so processes started alongside this one wait for its sprites rather than load their own.
+    std::shared_ptr<SpriteStore::Claim> claim;
+    if (!sharedName.empty() && !animPaths.empty()) {
+        sprites = SpriteStore::Attach(sharedName, fingerprint, claim);
+        if (sprites) {
+            std::cout << "Attached to shared sprites '" << sharedName << "'.\n";
         }
-        QuadtreeParameters params;
-        params.minSize = options["min-size"].as<int>();
-        params.background = parseColor(options["background"].as<std::string>());
-        frameBuilders.emplace_back(path, std::move(params), checker);
-        lastPath = std::move(path);
     }
-
-    if (frameBuilders.empty()) {
+    if (!sprites) {
+        sprites = loadSprites(animPaths);
+    }
+    if (!sprites) {
         std::cerr << "No animation frames found, aborting...\n";
         return;
     }
 
-    std::cout << "Found " << frameBuilders.size() << " animation frames.\n";
+    std::cout << "Found " << sprites->FrameCount() << " animation frames.\n";
+
+    // JPEG inputs are decoded no larger than the output needs, and to the red channel alone when no variant needs
+    // more of the frame than black and white analysis reads. The first input frame stands in for the rest.
+    DecodeHints hints;
+    int firstWidth = 0;
+    int firstHeight = 0;
+    int firstChannels = 0;
+    auto firstInput = std::format(inputPat, options["input-start"].as<int>());
+    bool haveFirst = Image::info(firstInput.c_str(), firstWidth, firstHeight, firstChannels);
+    if (haveFirst && options.count("out-resolution")) {
+        int outRes = options["out-resolution"].as<int>();
+        while (hints.scale < 8 && (firstHeight + 2 * hints.scale - 1) / (2 * hints.scale) >= outRes) {
+            hints.scale *= 2;
+        }
+    }
+
+    QuadtreeParameters params;
+    params.minSize = options["min-size"].as<int>();
+    params.background = parseColor(options["background"].as<std::string>());
+    params.phaseOffsets = options["phase-offsets"].as<bool>();
+    params.mipSprites = options["mip-sprites"].as<bool>();
+    params.fieldSprites = options["field-sprites"].as<bool>();
+    if (options.count("splits")) {
+        params.splits = options["splits"].as<std::vector<int>>();
+        for (int split : params.splits) {
+            if (split < 2 || split > maxSplit) {
+                std::cerr << "Splits must be between 2 and " << maxSplit << ", clamping " << split << ".\n";
+            }
+        }
+    }
+    params.rootCell = std::max(options["root-cell"].as<int>(), 0);
+    params.blockAlign = std::max(options["block-align"].as<int>(), 0);
+    if (options.count("out-resolution")) {
+        params.outputHeight = options["out-resolution"].as<int>();
+        params.minOutputSize = std::max(options["min-output-size"].as<int>(), 1);
+    }
+    // Leaf sizes are chosen for the frames as stored, however small they're decoded.
+    params.sourceHeight = firstHeight;
+    auto matcher = createSpriteMatcher(options, sprites);
+    std::vector<Quadtree> trees;
+    trees.emplace_back(sprites, params, checker, matcher);
+    if (options.count("variants")) {
+        for (const auto &variant : options["variants"].as<std::vector<std::string>>()) {
+            auto colon = variant.find(':');
+            auto equals = variant.find('=');
+            SubdivisionChecker::Ptr variantChecker;
+            if (colon < equals && equals != std::string::npos) {
+                try {
+                    variantChecker = createChecker(variant.substr(0, colon),
+                                                   std::stoi(variant.substr(colon + 1, equals - colon - 1)));
+                } catch (std::exception &) {
+                }
+            }
+            if (!variantChecker) {
+                std::cerr << "Ignoring malformed variant: '" << variant << "'\n";
+                continue;
+            }
+            trees.emplace_back(sprites, params, std::move(variantChecker), matcher);
+            outputPats.push_back(variant.substr(equals + 1));
+        }
+        std::cout << "Rendering " << trees.size() << " variants per frame.\n";
+    }
+
+    hints.redOnly = haveFirst && firstChannels == 3 &&
+                    std::none_of(trees.begin(), trees.end(),
+                                 [](const Quadtree &tree) { return tree.NeedsColor() || tree.NeedsLuma(); });
+
+    if (claim) {
+        // Leaf sizes depend on the frame dimensions, so take them from the first input frame. Mip chains and
+        // distance fields are built by each process from the frames and never published, so with --mip-sprites or
+        // --field-sprites only the frames themselves are shared.
+        std::vector<std::pair<int, int>> sizes;
+        if (haveFirst && !params.mipSprites && !params.fieldSprites) {
+            // Scaled JPEG decodes are what gets analyzed. PNGs ignore the scale and so cache sizes of their own.
+            sizes = trees[0].GetLeafSizes((firstWidth + hints.scale - 1) / hints.scale,
+                                          (firstHeight + hints.scale - 1) / hints.scale);
+        }
+        if (sprites->Publish(*claim, sizes)) {
+            std::cout << "Published sprites to shared memory as '" << sharedName << "'.\n";
+        }
+    }
 
-    thread_pool pool(static_cast<std::uint_fast32_t>(options["threads"].as<int>()));
+    int threads = options["threads"].as<int>();
+    thread_pool pool(static_cast<std::uint_fast32_t>(threads));
+    // Without threads of their own, PNG encoders deflate each band on the thread that drew it.
+    int idleCores = static_cast<int>(std::thread::hardware_concurrency()) - threads;
+    PngStreamEncoder::SetThreadLimit(options.count("png-threads") ? options["png-threads"].as<int>() : idleCores);
 
-    auto getFrameBuilder = [&, repeat = options["repeat"].as<int>(), repeatIndex = 0, frameIndex = 0]() mutable {
+    auto getFramePhase = [&, repeat = options["repeat"].as<int>(), repeatIndex = 0, phase = 0]() mutable {
         if (repeatIndex >= repeat) {
             repeatIndex = 0;
-            ++frameIndex;
+            ++phase;
         }
-        if (frameIndex >= frameBuilders.size()) {
-            frameIndex = 0;
+        if (phase >= sprites->FrameCount()) {
+            phase = 0;
         }
         ++repeatIndex;
-        auto &ret = frameBuilders[frameIndex];
-        ret.AddUse();
-        return &ret;
+        return phase;
     };
 
     std::cout << "Generating frame tasks...\n";
+    int inputStart = options["input-start"].as<int>();
+    int interpolate = std::max(options["interpolate"].as<int>(), 1);
+    auto getOutputPaths = [&](int index) {
+        std::vector<fs::path> paths;
+        for (const auto &pattern : outputPats) {
+            paths.emplace_back(std::format(pattern, index));
+        }
+        return paths;
+    };
+
+    std::vector<FrameJob> jobs;
     int taskCount = 0;
+    for (int frameIndex = inputStart;; ++frameIndex) {
+        fs::path inPath(std::format(inputPat, frameIndex));
+        if (inPath == lastPath || !fs::exists(inPath)) {
+            break;
+        }
+        lastPath = inPath;
+
+        // Output indices are spread out to leave room for the frames synthesized in between.
+        int outIndex = inputStart + (frameIndex - inputStart) * interpolate;
+        if (!jobs.empty()) {
+            for (int i = outIndex - interpolate + 1; i < outIndex; ++i) {
+                jobs.back().between.push_back({getOutputPaths(i), i, getFramePhase()});
+                ++taskCount;
+            }
+        }
+        int w, h, c;
+        double pixels = Image::info(inPath.string().c_str(), w, h, c) ? static_cast<double>(w) * h : 0;
+        jobs.push_back({std::move(inPath), {getOutputPaths(outIndex), outIndex, getFramePhase()}, {}, pixels});
+        ++taskCount;
+    }
 
     std::atomic_int tasksDone = 0;
     std::condition_variable cv;
     std::mutex cvMutex;
+    std::function<void()> frameDone = [&] {
+        {
+            std::unique_lock lock(cvMutex);
+            ++tasksDone;
+        }
+        cv.notify_one();
+    };
 
-    std::optional<int> outRes;
+    FrameIO io;
+    io.hints = hints;
     if (options.count("out-resolution")) {
-        outRes = options["out-resolution"].as<int>();
+        io.outRes = options["out-resolution"].as<int>();
+    }
+    io.fps = options["fps"].as<int>();
+    for (const auto &pattern : outputPats) {
+        fs::path path(pattern);
+        if (path.extension() == ".y4m" && pattern.find("{}") == std::string::npos && !io.streams.count(path)) {
+            if (path.has_parent_path()) {
+                fs::create_directories(path.parent_path());
+            }
+            io.streams.emplace(path, std::make_unique<Y4mWriter>(pattern, inputStart, io.fps));
+        }
+    }
+    if (options.count("denoise")) {
+        io.denoise = std::clamp(options["denoise"].as<int>(), 0, std::max({firstWidth, firstHeight, 1}));
+    }
+    if (options.count("heatmaps")) {
+        io.heatmapTile = std::max(options["heatmaps"].as<int>(), 1);
+    }
+    if (options.count("record-trace")) {
+        io.trace = std::make_unique<LeafTraceWriter>(options["record-trace"].as<std::string>(), params);
+    }
+    if (auto decoder = options["decoder"].as<std::string>(); decoder == "fast") {
+        io.decoder = ImageDecoder::Fast;
+    } else if (decoder == "verify") {
+        io.decoder = ImageDecoder::Verify;
+    } else if (decoder != "stb") {
+        std::cerr << "Unknown decoder: '" << decoder << "', using stb.\n";
     }
 
-    for (int frameIndex = options["input-start"].as<int>();; ++frameIndex) {
-        fs::path inPath(std::format(inputPat, frameIndex));
-        fs::path outPath(std::format(outputPat, frameIndex));
-        if (inPath == lastPath || !fs::exists(inPath)) {
-            break;
+    // Previews go to the front of the queue; being a fraction of a frame's work each, they hardly delay the full pass.
+    // Nothing may wait on the pool before the full pass is queued as well, or it would wait for every preview first.
+    if (options.count("preview")) {
+        int every = std::max(options["preview"].as<int>(), 1);
+        auto previewPat = options["preview-output"].as<std::string>();
+        auto previewParams = params;
+        previewParams.mipSprites = true;
+        // Previews are saved at the size they're analyzed at.
+        previewParams.outputHeight = 0;
+        previewParams.sourceHeight = 0;
+        auto preview = std::make_shared<Quadtree>(sprites, previewParams, checker, matcher);
+        for (std::size_t i = 0; i < jobs.size(); i += every) {
+            ++taskCount;
+            pool.submit([&, preview, previewPat, i] {
+                TRACE_SCOPE("task: preview");
+                fs::path outPath(std::format(previewPat, jobs[i].out.index));
+                try {
+                    renderPreview(*preview, jobs[i], outPath, io);
+                } catch (std::exception &e) {
+                    std::cerr << "Preview for " << jobs[i].inPath << " threw an exception: " << e.what() << "\n";
+                }
+                frameDone();
+            });
+        }
+    }
+
+    // With --scene-cuts, frames are processed in order in slices of consecutive frames, as many slices at once as
+    // there are threads. Cuts are only found as frames are analyzed, so slices are evenly sized, and short enough to
+    // give every thread one.
+    std::vector<std::pair<std::size_t, std::size_t>> slices;
+    std::optional<double> cutThreshold;
+    if (options.count("scene-cuts")) {
+        auto count = jobs.size();
+        auto workers = static_cast<std::size_t>(pool.get_thread_count());
+        auto length = std::clamp<std::size_t>((count + workers - 1) / workers, 1,
+                                              static_cast<std::size_t>(std::max(options["max-chunk"].as<int>(), 1)));
+        for (std::size_t first = 0; first < count; first += length) {
+            slices.emplace_back(first, std::min(first + length, count));
+        }
+        cutThreshold = options["scene-cuts"].as<double>();
+    }
+
+    // Frames between two analyzed frames rendered once both are, and not by a slice: all of them without slices, and
+    // those between slices with them. Signatures of the frames on either side tell if there's a cut between them.
+    std::vector<bool> paired(jobs.size());
+    for (std::size_t i = 0; i + 1 < jobs.size(); ++i) {
+        paired[i] = !jobs[i].between.empty() && slices.empty();
+    }
+    for (auto [first, last] : slices) {
+        paired[last - 1] = last < jobs.size() && !jobs[last - 1].between.empty();
+    }
+    std::vector<FrameSignature> signatures(cutThreshold ? jobs.size() : 0);
+
+    // Leaves of each analyzed frame, kept until the paired frames on both sides of it have been synthesized.
+    // Whichever frame of a pair finishes last schedules the frames between them.
+    std::vector<std::optional<AnalyzedFrame>> analyzed(jobs.size());
+    std::vector<int> analyzedUses(jobs.size());
+    std::vector<bool> finished(jobs.size());
+    std::mutex analyzedMutex;
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        analyzedUses[i] = (i > 0 && paired[i - 1]) + paired[i];
+    }
+
+    auto releaseAnalyzed = [&](std::size_t i) {
+        std::unique_lock lock(analyzedMutex);
+        if (--analyzedUses[i] == 0) {
+            analyzed[i] = std::nullopt;
         }
-        pool.submit([inPath = std::move(inPath), outPath = std::move(outPath), builder = getFrameBuilder(), outRes, &cv,
-                     &cvMutex, &tasksDone] {
-            if (outPath.has_parent_path()) {
-                fs::create_directories(outPath.parent_path());
+    };
+
+    auto frameAnalyzed = [&](std::size_t i, std::optional<AnalyzedFrame> result) {
+        std::vector<std::size_t> ready;
+        {
+            std::unique_lock lock(analyzedMutex);
+            if (analyzedUses[i] > 0) {
+                analyzed[i] = std::move(result);
             }
-            try {
-                auto &tree = builder->GetTree();
-                auto frame = tree.ProcessFrame(Image(inPath.string().c_str()));
-                builder->Release();
-
-                if (outRes) {
-                    int h = *outRes;
-                    if (h % 2) {
-                        ++h;
-                    }
-                    int w = frame.width() * h / frame.height();
-                    if (w % 2) {
-                        ++w;
-                    }
-                    frame = frame.resizeFastNew(w, h);
-                }
-                frame.save(outPath.string().c_str());
-            } catch (std::exception &e) {
-                std::cerr << "Process for " << inPath << " threw an exception: " << e.what() << "\n";
+            finished[i] = true;
+            if (i > 0 && finished[i - 1] && paired[i - 1]) {
+                ready.push_back(i - 1);
             }
-            {
-                std::unique_lock lock(cvMutex);
-                ++tasksDone;
+            if (i + 1 < jobs.size() && finished[i + 1] && paired[i]) {
+                ready.push_back(i);
             }
-            cv.notify_one();
-        });
-        ++taskCount;
-    }
+        }
+        for (auto k : ready) {
+            pool.submit([&, k] {
+                TRACE_SCOPE("task: between");
+                bool cut = cutThreshold && SignatureDistance(signatures[k], signatures[k + 1]) > *cutThreshold;
+                auto *from = analyzed[k] ? &*analyzed[k] : nullptr;
+                auto *to = analyzed[k + 1] && !cut ? &*analyzed[k + 1] : nullptr;
+                renderBetween(trees, jobs[k], from, to, io, frameDone);
+                releaseAnalyzed(k);
+                releaseAnalyzed(k + 1);
+            });
+        }
+    };
 
-    for (auto &builder : frameBuilders) {
-        builder.AllowRelease();
+    // Frames and slices vary in cost several-fold, so instead of in index order they start longest predicted first
+    // within a window. Expensive ones near the end then no longer leave most threads idle while they finish.
+    int window = options["dispatch-window"].as<int>();
+    if (window <= 0) {
+        window = 2 * static_cast<int>(pool.get_thread_count());
+    }
+    std::optional<LongestFirstQueue> dispatch;
+
+    if (!slices.empty()) {
+        std::cout << "Split into " << slices.size() << " slices.\n";
+        // A slice renders every frame it outputs, including the interpolated ones.
+        std::vector<double> slicePixels;
+        for (auto [first, last] : slices) {
+            double pixels = 0;
+            for (auto i = first; i < last; ++i) {
+                pixels += jobs[i].pixels * static_cast<double>(1 + jobs[i].between.size());
+            }
+            slicePixels.push_back(pixels);
+        }
+        dispatch.emplace(std::move(slicePixels), static_cast<std::size_t>(window));
+        auto edgeDone = [&](std::size_t i, std::optional<AnalyzedFrame> result, const FrameSignature &signature) {
+            signatures[i] = signature;
+            frameAnalyzed(i, std::move(result));
+        };
+        for (std::size_t n = 0; n < slices.size(); ++n) {
+            pool.submit([&, edgeDone] {
+                TRACE_SCOPE("task: slice");
+                auto k = dispatch->Next();
+                auto [first, last] = slices[k];
+                processSlice(trees, jobs, first, last, *cutThreshold, io, frameDone, edgeDone);
+                dispatch->Done(k);
+            });
+        }
+    } else {
+        std::vector<double> framePixels;
+        for (const auto &job : jobs) {
+            framePixels.push_back(job.pixels);
+        }
+        dispatch.emplace(std::move(framePixels), static_cast<std::size_t>(window));
+        for (std::size_t n = 0; n < jobs.size(); ++n) {
+            pool.submit([&] {
+                TRACE_SCOPE("task: frame");
+                auto i = dispatch->Next();
+                std::optional<AnalyzedFrame> result;
+                try {
+                    result = analyzeAndSave(trees, jobs[i], io);
+                } catch (std::exception &e) {
+                    std::cerr << "Process for " << jobs[i].inPath << " threw an exception: " << e.what() << "\n";
+                    skipFrame(jobs[i].out, io);
+                }
+                dispatch->Done(i);
+                frameDone();
+                frameAnalyzed(i, std::move(result));
+            });
+        }
     }
 
     std::cout << "Processing " << taskCount << " frames...\n";
@@ -0,0 +1,39 @@
+#ifndef TESTIMAGES_H
+#define TESTIMAGES_H
+
+// Fixtures shared by the PNG tests.
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "Image.h"
+
+inline std::vector<byte> readFile(const std::filesystem::path &path) {
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+// A w by h image with c channels of noise (kind 0), gradients (kind 1) or a flat area with specks (kind 2), which favor
+// different row filters and matches.
+inline Image MakeTestImage(int w, int h, int c, int kind, std::mt19937 &rng) {
+    Image image(w, h, c);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            for (int k = 0; k < c; ++k) {
+                unsigned value = 128;
+                if (kind == 0 || (kind == 2 && rng() % 8 == 0)) {
+                    value = rng();
+                } else if (kind == 1) {
+                    value = (x / 7 + y / 5) * 37 + k * 50;
+                }
+                image(x, y, k) = static_cast<byte>(value);
+            }
+        }
+    }
+    return image;
+}
+
+#endif
@@ -0,0 +1,101 @@
+// Checks that SubdivisionColor::Merge, vectorized where SSE2 is available, agrees with the scalar version it replaced
+// on a grid of extreme colors, on every pair of values in each channel and on random quads at every threshold.
+
+#include <array>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "Quadtree.h"
+#include "bench/ScalarColorChecker.h"
+
+using Quad = std::array<RgbColor, 4>;
+
+byte &channel(RgbColor &color, int c) { return c == 0 ? color.r : c == 1 ? color.g : color.b; }
+
+struct Checkers {
+    SubdivisionChecker::Ptr fast;
+    ScalarColorChecker scalar;
+};
+
+bool agrees(const Checkers &checkers, const Quad &q) {
+    auto [mergeFast, colorFast] = checkers.fast->Merge(q[0], q[1], q[2], q[3]);
+    auto [mergeScalar, colorScalar] = checkers.scalar.Merge(q[0], q[1], q[2], q[3]);
+    return mergeFast == mergeScalar && colorFast.r == colorScalar.r && colorFast.g == colorScalar.g &&
+           colorFast.b == colorScalar.b;
+}
+
+// Returns the number of quads the two disagree on, printing the first few.
+int64_t checkEquivalence(int64_t randomCount) {
+    // Thresholds on either side of the distances the grid produces: 3 * 147^2 < 255^2 < 3 * 148^2.
+    std::vector<Checkers> checkers;
+    for (int threshold : {0, 1, 2, 147, 148, 255}) {
+        checkers.push_back({CreateSubdivisionChecker(ColorParameters{threshold}), ColorParameters{threshold}});
+    }
+
+    int64_t failures = 0;
+    auto check = [&](const Checkers &c, const Quad &q) {
+        if (!agrees(c, q) && ++failures <= 5) {
+            std::cerr << "Mismatch:";
+            for (const auto &color : q) {
+                std::cerr << std::format(" ({}, {}, {})", color.r, color.g, color.b);
+            }
+            std::cerr << "\n";
+        }
+    };
+
+    // Every combination of 0, 1, 254 and 255 in all twelve channels.
+    constexpr std::array<byte, 4> levels = {0, 1, 254, 255};
+    for (uint32_t code = 0; code < 1u << 24; ++code) {
+        Quad q;
+        for (int i = 0; i < 4; ++i) {
+            q[i] = {levels[code >> (6 * i) & 3], levels[code >> (6 * i + 2) & 3], levels[code >> (6 * i + 4) & 3]};
+        }
+        for (const auto &c : checkers) {
+            check(c, q);
+        }
+    }
+
+    // Every pair of values in every channel of every pair of children, with the other children in between.
+    for (int a = 0; a < 4; ++a) {
+        for (int b = a + 1; b < 4; ++b) {
+            for (int c = 0; c < 3; ++c) {
+                for (int x = 0; x < 256; ++x) {
+                    for (int y = 0; y < 256; ++y) {
+                        Quad q;
+                        q.fill({128, 128, 128});
+                        channel(q[a], c) = static_cast<byte>(x);
+                        channel(q[b], c) = static_cast<byte>(y);
+                        check(checkers[3], q);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<Checkers> everyThreshold;
+    for (int threshold = 0; threshold < 256; ++threshold) {
+        everyThreshold.push_back({CreateSubdivisionChecker(ColorParameters{threshold}), ColorParameters{threshold}});
+    }
+    std::mt19937 rng(1);
+    for (int64_t i = 0; i < randomCount; ++i) {
+        Quad q;
+        for (auto &color : q) {
+            uint32_t bits = rng();
+            color = {static_cast<byte>(bits), static_cast<byte>(bits >> 8), static_cast<byte>(bits >> 16)};
+        }
+        check(everyThreshold[rng() % 256], q);
+    }
+    return failures;
+}
+
+int main() {
+    if (auto failures = checkEquivalence(1000000)) {
+        std::cerr << failures << " mismatches against the scalar version.\n";
+        return 1;
+    }
+    std::cout << "No mismatches against the scalar version.\n";
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Checks DecodePng against stb_image: PNGs written by Image::save in every channel count at sizes down to a single
+// pixel, with content that gives each row filter a turn, and any PNGs in the directory given on the command line, which
+// come from other encoders. Every file DecodePng accepts must decode to exactly the pixels stbi_load returns.
+
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Image.h"
+#include "PngDecoder.h"
+#include "TestImages.h"
+
+namespace fs = std::filesystem;
+
+// Returns whether DecodePng agrees with stb_image on the file, printing what's wrong if it doesn't. Files DecodePng
+// declines only count as failures if required.
+bool matchesStb(const fs::path &path, bool required) {
+    auto file = readFile(path);
+    std::vector<byte> pixels;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    if (!DecodePng(file.data(), file.size(), pixels, width, height, channels)) {
+        if (required) {
+            std::cerr << path.string() << ": not decoded\n";
+        }
+        return !required;
+    }
+    Image reference(path.string().c_str());
+    ImageView view = reference.view();
+    if (width != view.width || height != view.height || channels != view.channels ||
+        !std::equal(pixels.begin(), pixels.end(), view.data, view.data + reference.byteSize())) {
+        std::cerr << std::format("{}: decoded to {}x{}x{}, stb_image gives {}x{}x{}\n", path.string(), width, height,
+                                 channels, view.width, view.height, view.channels);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    auto dir = fs::temp_directory_path() / "amoguifier_test_png_decoder";
+    fs::create_directories(dir);
+
+    std::mt19937 rng(1);
+    int checked = 0;
+    int failures = 0;
+    for (int c = 1; c <= 4; ++c) {
+        for (auto [w, h] : {std::pair{1, 1}, {2, 1}, {1, 3}, {3, 300}, {300, 2}, {257, 131}}) {
+            for (int kind = 0; kind < 3; ++kind) {
+                Image image = MakeTestImage(w, h, c, kind, rng);
+                auto path = dir / std::format("{}_{}x{}_{}.png", c, w, h, kind);
+                if (!image.save(path.string().c_str())) {
+                    std::cerr << "Can't write " << path.string() << "\n";
+                    return 1;
+                }
+                failures += !matchesStb(path, true);
+                ++checked;
+            }
+        }
+    }
+
+    if (argc > 1) {
+        for (const auto &entry : fs::directory_iterator(argv[1])) {
+            if (entry.path().extension() == ".png") {
+                failures += !matchesStb(entry.path(), false);
+                ++checked;
+            }
+        }
+    }
+
+    fs::remove_all(dir);
+    std::cout << std::format("{} of {} PNGs decoded differently.\n", failures, checked);
+    return failures ? 1 : 0;
+}
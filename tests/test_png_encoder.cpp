@@ -0,0 +1,59 @@
+// Checks that PngStreamEncoder writes the same bytes as Image::save, in every channel count at sizes down to a single
+// pixel, with content that gives each row filter a turn and rows reported finished in random bands. Runs with and
+// without an encoder thread, and drops an encoder before it's finished.
+
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <random>
+
+#include "Image.h"
+#include "PngEncoder.h"
+#include "TestImages.h"
+
+namespace fs = std::filesystem;
+
+int main() {
+    auto dir = fs::temp_directory_path() / "amoguifier_test_png_encoder";
+    fs::create_directories(dir);
+    auto expectedPath = (dir / "expected.png").string();
+    auto encodedPath = (dir / "encoded.png").string();
+
+    std::mt19937 rng(1);
+    int checked = 0;
+    int failures = 0;
+    for (int threads : {0, 1}) {
+        PngStreamEncoder::SetThreadLimit(threads);
+        for (int c = 1; c <= 4; ++c) {
+            for (auto [w, h] : {std::pair{1, 1}, {2, 1}, {1, 3}, {3, 300}, {300, 2}, {257, 131}, {640, 360}}) {
+                for (int kind = 0; kind < 3; ++kind) {
+                    Image image = MakeTestImage(w, h, c, kind, rng);
+                    if (!image.save(expectedPath.c_str())) {
+                        std::cerr << "Can't write " << expectedPath << "\n";
+                        return 1;
+                    }
+
+                    PngStreamEncoder encoder(image);
+                    for (int rows = 0; rows < h; rows += 1 + static_cast<int>(rng() % 40)) {
+                        encoder.RowsDone(rows);
+                    }
+                    if (!encoder.Finish(encodedPath.c_str()) || readFile(expectedPath) != readFile(encodedPath)) {
+                        std::cerr << std::format("{} channels, {}x{}, content {}, {} threads: files differ\n", c, w,
+                                                 h, kind, threads);
+                        ++failures;
+                    }
+                    ++checked;
+                }
+            }
+        }
+
+        // Dropped halfway, the encoder has to stop without writing anything.
+        Image image(64, 64, 3);
+        PngStreamEncoder encoder(image);
+        encoder.RowsDone(10);
+    }
+
+    fs::remove_all(dir);
+    std::cout << std::format("{} of {} PNGs encoded differently.\n", failures, checked);
+    return failures ? 1 : 0;
+}